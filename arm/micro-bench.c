@@ -19,6 +19,7 @@
  * This work is licensed under the terms of the GNU LGPL, version 2.
  */
 #include <libcflat.h>
+#include <bench.h>
 #include <asm/gic.h>
 
 #define NTIMES (1U << 16)
@@ -173,6 +174,7 @@ static void loop_test(struct exit_test *test)
 {
 	uint64_t start, end, total_ticks, ntimes = NTIMES;
 	struct ns_time total_ns, avg_ns;
+	struct bench_stats stats;
 
 	if (test->prep)
 		test->prep();
@@ -191,6 +193,11 @@ static void loop_test(struct exit_test *test)
 
 	printf("%-30s%15" PRId64 ".%-15" PRId64 "%15" PRId64 ".%-15" PRId64 "\n",
 		test->name, total_ns.ns, total_ns.ns_frac, avg_ns.ns, avg_ns.ns_frac);
+
+	/* Picoseconds keep the sub-nanosecond part of the average. */
+	bench_stats_mean(&stats, total_ns.ns * 1000 + total_ns.ns_frac * 100,
+			 NTIMES);
+	bench_report(test->name, "ps", &stats);
 }
 
 int main(int argc, char **argv)
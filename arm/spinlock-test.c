@@ -11,12 +11,16 @@
  */
 
 #include <libcflat.h>
+#include <bench.h>
 #include <asm/smp.h>
 #include <asm/barrier.h>
+#include <asm/processor.h>
+#include <asm/spinlock.h>
 
 #define LOOP_SIZE 10000000
 
 struct lock_ops {
+	const char *name;
 	void (*lock)(int *v);
 	void (*unlock)(int *v);
 };
@@ -40,16 +44,44 @@ static void none_unlock(int *lock_var)
 	*(volatile int *)lock_var = 0;
 }
 
+/*
+ * The lock variants from asm-generic/spinlock-variants.h, and the
+ * configured struct spinlock, ignore the int lock variable.
+ */
+static struct tas_lock tas;
+static struct ticket_lock ticket;
+static struct mcs_lock mcs;
+static struct spinlock spin;
+
+static void tas_lock_op(int *v) { tas_spin_lock(&tas); }
+static void tas_unlock_op(int *v) { tas_spin_unlock(&tas); }
+static void ticket_lock_op(int *v) { ticket_spin_lock(&ticket); }
+static void ticket_unlock_op(int *v) { ticket_spin_unlock(&ticket); }
+static void mcs_lock_op(int *v) { mcs_spin_lock(&mcs); }
+static void mcs_unlock_op(int *v) { mcs_spin_unlock(&mcs); }
+static void spin_lock_op(int *v) { spin_lock(&spin); }
+static void spin_unlock_op(int *v) { spin_unlock(&spin); }
+
+static const struct lock_ops all_ops[] = {
+	{ "tas", tas_lock_op, tas_unlock_op },
+	{ "ticket", ticket_lock_op, ticket_unlock_op },
+	{ "mcs", mcs_lock_op, mcs_unlock_op },
+	{ "spinlock", spin_lock_op, spin_unlock_op },
+};
+
 static int global_a, global_b;
 static int global_lock;
+static u64 elapsed[NR_CPUS];
 
 static void test_spinlock(void *data __unused)
 {
 	int i, errors = 0;
 	int cpu = smp_processor_id();
+	u64 t;
 
 	printf("CPU%d online\n", cpu);
 
+	t = get_cntvct();
 	for (i = 0; i < LOOP_SIZE; i++) {
 
 		lock_ops.lock(&global_lock);
@@ -67,21 +99,62 @@ static void test_spinlock(void *data __unused)
 
 		lock_ops.unlock(&global_lock);
 	}
+	elapsed[cpu] = get_cntvct() - t;
 	report(errors == 0, "CPU%d: Done - Errors: %d", cpu, errors);
 }
 
+/*
+ * All CPUs take the lock LOOP_SIZE times, so with a fair lock they all
+ * finish together.  Fairness is the first finish time relative to the
+ * last one, in permille.
+ */
+static void report_bench(void)
+{
+	u64 min = -1ull, max = 0, ns;
+	struct bench_stats stats;
+	char name[48];
+	int cpu;
+
+	for_each_present_cpu(cpu) {
+		min = MIN(min, elapsed[cpu]);
+		max = MAX(max, elapsed[cpu]);
+	}
+	ns = max * 1000000000ull / get_cntfrq();
+
+	printf("%s, %d cpus: %" PRIu64 " ns per acquisition, "
+	       "fairness %" PRIu64 "/1000\n", lock_ops.name, nr_cpus,
+	       ns / ((u64)LOOP_SIZE * nr_cpus), min * 1000 / max);
+
+	snprintf(name, sizeof(name), "lock_%s_%dcpu", lock_ops.name, nr_cpus);
+	bench_stats_mean(&stats, ns, (u64)LOOP_SIZE * nr_cpus);
+	bench_report(name, "ns", &stats);
+
+	snprintf(name, sizeof(name), "lock_%s_%dcpu_fairness", lock_ops.name,
+		 nr_cpus);
+	bench_stats_mean(&stats, min * 1000 / max, 1);
+	bench_report(name, "permille", &stats);
+}
+
 int main(int argc, char **argv)
 {
+	int i;
+
 	report_prefix_push("spinlock");
 	if (argc > 1 && strcmp(argv[1], "bad") != 0) {
+		lock_ops.name = "gcc_builtin";
 		lock_ops.lock = gcc_builtin_lock;
 		lock_ops.unlock = gcc_builtin_unlock;
+		for (i = 0; i < ARRAY_SIZE(all_ops); i++)
+			if (!strcmp(argv[1], all_ops[i].name))
+				lock_ops = all_ops[i];
 	} else {
+		lock_ops.name = "none";
 		lock_ops.lock = none_lock;
 		lock_ops.unlock = none_unlock;
 	}
 
 	on_cpus(test_spinlock, NULL);
+	report_bench();
 
 	return report_summary();
 }
@@ -1,5 +1,6 @@
 #include "alloc.h"
 #include "asm/page.h"
+#include "asm/spinlock.h"
 
 void *malloc(size_t size)
 {
@@ -18,6 +19,120 @@ void *calloc(size_t nmemb, size_t size)
 #define OFS_SLACK	(-2 * sizeof(uintptr_t))
 #define OFS_SIZE	(-sizeof(uintptr_t))
 
+/*
+ * Once the backend hands out whole pages, small malloc()s are carved out
+ * of pages by a simple slab allocator instead.  Objects come in power of
+ * two size classes from SLAB_MIN to SLAB_MAX bytes, including a size word
+ * in front of them that has SLAB_OBJ set.  Free objects are kept on
+ * freelists of the CPU that freed them; architectures that can't tell
+ * the CPU (see page_alloc_cpu) share one set of lists under a lock.
+ * Slab pages are never given back to the backend.
+ */
+#define SLAB_MIN_SHIFT	3
+#define SLAB_MAX_SHIFT	11
+#define SLAB_MIN	(1ul << SLAB_MIN_SHIFT)
+#define SLAB_MAX	(1ul << SLAB_MAX_SHIFT)
+#define NR_SLAB_CLASSES	(SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+#define NR_SLAB_CPUS	256
+#define SLAB_OBJ	1ul
+
+struct slab_cache {
+	void *free[NR_SLAB_CLASSES];
+	struct malloc_stats stats;
+} __attribute__((aligned(64)));
+
+static struct slab_cache slab_caches[NR_SLAB_CPUS];
+static struct slab_cache slab_shared;
+static struct spinlock slab_lock;
+
+/* Only present if the page allocator is linked in. */
+extern int page_alloc_cpu(void) __attribute__((__weak__));
+
+static struct slab_cache *slab_get(void)
+{
+	int cpu = page_alloc_cpu ? page_alloc_cpu() : -1;
+
+	if (cpu >= 0 && cpu < NR_SLAB_CPUS)
+		return &slab_caches[cpu];
+	spin_lock(&slab_lock);
+	return &slab_shared;
+}
+
+static void slab_put(struct slab_cache *sc)
+{
+	if (sc == &slab_shared)
+		spin_unlock(&slab_lock);
+}
+
+static bool slab_usable(size_t alignment, size_t size)
+{
+	return alignment <= sizeof(uintptr_t) &&
+	       size <= SLAB_MAX - sizeof(uintptr_t) &&
+	       alloc_ops->align_min >= PAGE_SIZE;
+}
+
+static void *slab_alloc(size_t size)
+{
+	unsigned int c = 0;
+	struct slab_cache *sc;
+	uintptr_t *obj;
+	void *page;
+	size_t i;
+
+	while ((SLAB_MIN << c) < size + sizeof(uintptr_t))
+		c++;
+
+	sc = slab_get();
+	if (!sc->free[c]) {
+		page = alloc_ops->memalign(PAGE_SIZE, PAGE_SIZE);
+		assert(page);
+		for (i = 0; i < PAGE_SIZE; i += SLAB_MIN << c) {
+			*(void **)(page + i) = sc->free[c];
+			sc->free[c] = page + i;
+		}
+		sc->stats.slab_pages++;
+	}
+	obj = sc->free[c];
+	sc->free[c] = *(void **)obj;
+	sc->stats.slab_allocs++;
+	sc->stats.slab_bytes += size;
+	slab_put(sc);
+
+	/* Callers rely on malloc() returning zeroed memory. */
+	obj[0] = (SLAB_MIN << c) | SLAB_OBJ;
+	memset(&obj[1], 0, size);
+	return &obj[1];
+}
+
+static void slab_free(void *ptr, uintptr_t size)
+{
+	struct slab_cache *sc = slab_get();
+	unsigned int c = 0;
+	void *obj = ptr - sizeof(uintptr_t);
+
+	while ((SLAB_MIN << c) < size)
+		c++;
+
+	*(void **)obj = sc->free[c];
+	sc->free[c] = obj;
+	slab_put(sc);
+}
+
+void malloc_get_stats(struct malloc_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i <= NR_SLAB_CPUS; i++) {
+		struct slab_cache *sc = i < NR_SLAB_CPUS ? &slab_caches[i]
+							 : &slab_shared;
+
+		stats->slab_allocs += sc->stats.slab_allocs;
+		stats->slab_bytes += sc->stats.slab_bytes;
+		stats->slab_pages += sc->stats.slab_pages;
+	}
+}
+
 static inline void *block_begin(void *mem)
 {
 	uintptr_t slack = *(uintptr_t *)(mem + OFS_SLACK);
@@ -31,11 +146,17 @@ static inline uintptr_t block_size(void *mem)
 
 void free(void *ptr)
 {
+	uintptr_t sz = block_size(ptr);
+
+	if (sz & SLAB_OBJ) {
+		slab_free(ptr, sz & ~SLAB_OBJ);
+		return;
+	}
+
 	if (!alloc_ops->free)
 		return;
 
 	void *base = block_begin(ptr);
-	uintptr_t sz = block_size(ptr);
 
 	alloc_ops->free(base, sz);
 }
@@ -52,6 +173,9 @@ void *memalign(size_t alignment, size_t size)
 	assert(alignment >= sizeof(void *) && is_power_of_2(alignment));
 	assert(alloc_ops && alloc_ops->memalign);
 
+	if (slab_usable(alignment, size))
+		return slab_alloc(size);
+
 	size += alignment - 1;
 	blkalign = MAX(alignment, alloc_ops->align_min);
 	size = ALIGN(size + METADATA_EXTRA, alloc_ops->align_min);
@@ -30,9 +30,18 @@ struct alloc_ops {
 
 extern struct alloc_ops *alloc_ops;
 
+struct malloc_stats {
+	/* allocations served by the slab, and the bytes they asked for */
+	unsigned long slab_allocs;
+	unsigned long slab_bytes;
+	/* pages backing the slab */
+	unsigned long slab_pages;
+};
+
 void *malloc(size_t size);
 void *calloc(size_t nmemb, size_t size);
 void free(void *ptr);
 void *memalign(size_t alignment, size_t size);
+void malloc_get_stats(struct malloc_stats *stats);
 
 #endif /* _ALLOC_H_ */
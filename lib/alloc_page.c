@@ -3,28 +3,266 @@
  *
  * This is a simple allocator that provides contiguous physical addresses
  * with page granularity.
+ *
+ * It is a binary buddy allocator: free memory is kept in naturally
+ * aligned blocks of (1 << order) pages, with one free list per order.
+ * Allocations split larger blocks as needed and freed blocks are merged
+ * with their buddy whenever the buddy is free too.
+ *
+ * Memory is handed to the allocator in areas, the first call to
+ * free_pages for a range that is not part of an existing area creates a
+ * new one.  The first pages of each area hold one byte of metadata for
+ * every page of the area.
+ *
+ * Single pages are additionally cached per CPU, so that alloc_page and
+ * free_page only take the global lock once every PCP_BATCH pages.  The
+ * caches are only used on architectures that implement page_alloc_cpu.
+ * They are not protected against interrupts, so pages must not be
+ * allocated or freed from interrupt handlers.
+ *
+ * Pages are zeroed when they are allocated, unless the caller passes
+ * ALLOC_NOZERO.  page_alloc_prezero can zero free pages in advance, e.g.
+ * on an otherwise idle CPU; the metadata remembers which free pages are
+ * known to be zero so that allocating them doesn't need a memset.  Only
+ * the free list links at the start of such a page have to be cleared.
  */
 #include "libcflat.h"
 #include "alloc.h"
 #include "alloc_phys.h"
 #include "alloc_page.h"
 #include "bitops.h"
+#include <linux/compiler.h>
 #include <asm/page.h>
 #include <asm/io.h>
 #include <asm/spinlock.h>
+#include "asm-generic/atomic.h"
+
+#define MAX_AREAS	4
+#define NLISTS		MIN(BITS_PER_LONG - PAGE_SHIFT, PAGE_ORDER_MASK + 1)
+
+#define NR_PCP		256
+#define PCP_BATCH	16
+#define PCP_HIGH	(2 * PCP_BATCH)
+#define PCP_ZERO	1ul
+
+/* Metadata byte of each page */
+#define PAGE_FREE	0x80	/* head of a free block, order in low bits */
+#define PAGE_USED	0x40	/* allocated or reserved */
+#define PAGE_TAIL	0x00	/* inside a free block */
+#define PAGE_ZERO	0x20	/* free page known to be zero, ORed to the above */
+#define PAGE_ORDER_MASK	0x1f
+
+struct free_block {
+	struct free_block *prev;
+	struct free_block *next;
+};
+
+struct mem_area {
+	/* virtual address of the first page */
+	void *start;
+	/* first page frame number and number of pages */
+	uintptr_t base;
+	uintptr_t npages;
+	u8 *page_states;
+};
+
+/*
+ * Per-CPU cache of single pages, only ever touched by its own CPU.
+ * PCP_ZERO is set in the pointers of pages that are known to be zero.
+ */
+struct page_cache {
+	unsigned int count;
+	void *pages[PCP_HIGH];
+	struct page_alloc_stats stats;
+} __attribute__((aligned(64)));
 
 static struct spinlock lock;
-static void *freelist = 0;
+static struct mem_area areas[MAX_AREAS];
+static int nr_areas;
+static struct free_block freelists[NLISTS];
+static struct page_cache page_caches[NR_PCP];
+/* for CPUs without a cache, updated atomically */
+static struct page_alloc_stats global_stats;
+/* where page_alloc_prezero left off */
+static int zero_area;
+static uintptr_t zero_idx;
+/*
+ * Pages page_alloc_prezero has scanned since it last found one to zero,
+ * reset whenever pages are freed.  All free pages are zero once it
+ * reaches total_pages.
+ */
+static uintptr_t clean_run;
+static uintptr_t total_pages;
+
+/*
+ * Returns a small unique number for the calling CPU, or -1 if the
+ * architecture can't tell, in which case the per-CPU caches are not used.
+ */
+int __attribute__((__weak__)) page_alloc_cpu(void)
+{
+	return -1;
+}
+
+static struct page_cache *this_cpu_cache(void)
+{
+	int cpu = page_alloc_cpu();
+
+	if (cpu < 0 || cpu >= NR_PCP)
+		return NULL;
+	return &page_caches[cpu];
+}
 
 bool page_alloc_initialized(void)
 {
-	return freelist != 0;
+	return nr_areas != 0;
+}
+
+static void list_init(struct free_block *head)
+{
+	head->prev = head->next = head;
+}
+
+static bool list_empty(struct free_block *head)
+{
+	return head->next == head;
+}
+
+static void list_add(struct free_block *head, struct free_block *b)
+{
+	b->next = head->next;
+	b->prev = head;
+	head->next->prev = b;
+	head->next = b;
+}
+
+static void list_remove(struct free_block *b)
+{
+	b->prev->next = b->next;
+	b->next->prev = b->prev;
+}
+
+static struct mem_area *area_of(void *mem)
+{
+	int i;
+
+	for (i = 0; i < nr_areas; i++)
+		if (mem >= areas[i].start &&
+		    mem < areas[i].start + areas[i].npages * PAGE_SIZE)
+			return &areas[i];
+	return NULL;
+}
+
+/* Index of @mem in the area, not to be confused with the pfn. */
+static uintptr_t area_idx(struct mem_area *a, void *mem)
+{
+	return (mem - a->start) >> PAGE_SHIFT;
+}
+
+static void *area_page(struct mem_area *a, uintptr_t idx)
+{
+	return a->start + (idx << PAGE_SHIFT);
+}
+
+/*
+ * Returns the index of the buddy of the order @order block at @idx,
+ * or -1 if the buddy is not fully inside the area.
+ */
+static intptr_t buddy_idx(struct mem_area *a, uintptr_t idx,
+			  unsigned int order)
+{
+	uintptr_t pfn = (a->base + idx) ^ (1ul << order);
+
+	if (pfn < a->base || pfn - a->base + (1ul << order) > a->npages)
+		return -1;
+	return pfn - a->base;
+}
+
+/* Must be called with the lock held. */
+static void free_block(struct mem_area *a, uintptr_t idx, unsigned int order)
+{
+	uintptr_t i, n = 1ul << order;
+	intptr_t buddy;
+
+	for (i = 0; i < n; i++) {
+		assert_msg(a->page_states[idx + i] == PAGE_USED,
+			   "freeing page %p that is not allocated",
+			   area_page(a, idx + i));
+		/* The owner has most likely written to it. */
+		a->page_states[idx + i] = PAGE_TAIL;
+	}
+	clean_run = 0;
+
+	while (order < NLISTS - 1) {
+		buddy = buddy_idx(a, idx, order);
+		if (buddy < 0 || (a->page_states[buddy] & ~PAGE_ZERO) !=
+				 (PAGE_FREE | order))
+			break;
+		list_remove(area_page(a, buddy));
+		a->page_states[buddy] &= PAGE_ZERO;
+		idx = MIN(idx, (uintptr_t)buddy);
+		order++;
+	}
+
+	a->page_states[idx] |= PAGE_FREE | order;
+	list_add(&freelists[order], area_page(a, idx));
+}
+
+/*
+ * Frees @npages pages starting at @idx as the largest naturally aligned
+ * blocks that fit.  Must be called with the lock held.
+ */
+static void free_range(struct mem_area *a, uintptr_t idx, uintptr_t npages)
+{
+	uintptr_t end = idx + npages;
+	unsigned int order;
+
+	while (idx < end) {
+		order = 0;
+		while (order < NLISTS - 1 &&
+		       !((a->base + idx) & ((2ul << order) - 1)) &&
+		       idx + (2ul << order) <= end)
+			order++;
+		free_block(a, idx, order);
+		idx += 1ul << order;
+	}
+}
+
+/*
+ * Turns [mem, mem + size) into a new area and frees all of its pages
+ * except the ones needed for the metadata.  Must be called with the lock
+ * held.
+ */
+static void area_init(void *mem, unsigned long size)
+{
+	uintptr_t npages = size >> PAGE_SHIFT;
+	uintptr_t meta_pages = DIV_ROUND_UP(npages, PAGE_SIZE);
+	struct mem_area *a;
+	int i;
+
+	if (!nr_areas)
+		for (i = 0; i < NLISTS; i++)
+			list_init(&freelists[i]);
+
+	/* Not worth it, the metadata would eat up the whole range. */
+	if (npages <= meta_pages)
+		return;
+
+	assert_msg(nr_areas < MAX_AREAS, "too many memory areas");
+	a = &areas[nr_areas++];
+	a->start = mem;
+	a->base = virt_to_phys(mem) >> PAGE_SHIFT;
+	a->npages = npages;
+	a->page_states = mem;
+	total_pages += npages;
+
+	/* The metadata pages stay reserved forever. */
+	memset(a->page_states, PAGE_USED, npages);
+	free_range(a, meta_pages, npages - meta_pages);
 }
 
 void free_pages(void *mem, unsigned long size)
 {
-	void *old_freelist;
-	void *end;
+	struct mem_area *a;
 
 	assert_msg((unsigned long) mem % PAGE_SIZE == 0,
 		   "mem not page aligned: %p", mem);
@@ -35,116 +273,284 @@ void free_pages(void *mem, unsigned long size)
 		   (uintptr_t)mem + size > (uintptr_t)mem,
 		   "mem + size overflow: %p + %#lx", mem, size);
 
-	if (size == 0) {
-		freelist = NULL;
+	if (size == 0)
 		return;
-	}
 
 	spin_lock(&lock);
-	old_freelist = freelist;
-	freelist = mem;
-	end = mem + size;
-	while (mem + PAGE_SIZE != end) {
-		*(void **)mem = (mem + PAGE_SIZE);
-		mem += PAGE_SIZE;
+	a = area_of(mem);
+	if (!a) {
+		assert_msg(!area_of(mem + size - 1),
+			   "range %p-%p overlaps an existing area",
+			   mem, mem + size);
+		area_init(mem, size);
+	} else {
+		assert_msg(area_of(mem + size - 1) == a,
+			   "range %p-%p crosses an area boundary",
+			   mem, mem + size);
+		free_range(a, area_idx(a, mem), size >> PAGE_SHIFT);
 	}
-
-	*(void **)mem = old_freelist;
 	spin_unlock(&lock);
 }
 
 void free_pages_by_order(void *mem, unsigned long order)
 {
-	free_pages(mem, 1ul << (order + PAGE_SHIFT));
+	if (!order)
+		free_page(mem);
+	else
+		free_pages(mem, 1ul << (order + PAGE_SHIFT));
 }
 
-void *alloc_page()
+/*
+ * Takes an order @order block off the free lists, splitting a larger one
+ * if needed.  @zero is set if all of its pages are known to be zero.
+ * Must be called with the lock held.
+ */
+static void *alloc_block(unsigned long order, bool *zero)
 {
-	void *p;
+	struct free_block *b = NULL;
+	struct mem_area *a;
+	unsigned long o;
+	uintptr_t idx;
+
+	for (o = order; o < NLISTS; o++) {
+		if (!list_empty(&freelists[o])) {
+			b = freelists[o].next;
+			break;
+		}
+	}
 
-	if (!freelist)
-		return 0;
+	if (!b)
+		return NULL;
+
+	list_remove(b);
+	a = area_of(b);
+	idx = area_idx(a, b);
+
+	/* Give back the upper halves that are not needed. */
+	while (o > order) {
+		o--;
+		a->page_states[idx + (1ul << o)] |= PAGE_FREE | o;
+		list_add(&freelists[o], area_page(a, idx + (1ul << o)));
+	}
+
+	*zero = true;
+	for (o = 0; o < (1ul << order); o++) {
+		*zero &= !!(a->page_states[idx + o] & PAGE_ZERO);
+		a->page_states[idx + o] = PAGE_USED;
+	}
+
+	return b;
+}
+
+/* Gives @n pages of the cache back to the free lists. */
+static void pcp_drain(struct page_cache *pcp, unsigned int n)
+{
+	struct mem_area *a;
+	uintptr_t page, idx;
 
 	spin_lock(&lock);
-	p = freelist;
-	freelist = *(void **)freelist;
+	while (n-- && pcp->count) {
+		page = (uintptr_t)pcp->pages[--pcp->count];
+		a = area_of((void *)(page & ~PCP_ZERO));
+		idx = area_idx(a, (void *)(page & ~PCP_ZERO));
+		free_range(a, idx, 1);
+		if (page & PCP_ZERO)
+			a->page_states[idx] |= PAGE_ZERO;
+	}
 	spin_unlock(&lock);
+}
 
-	if (p)
-		memset(p, 0, PAGE_SIZE);
-	return p;
+static void pcp_refill(struct page_cache *pcp)
+{
+	void *page;
+	bool zero;
+
+	spin_lock(&lock);
+	while (pcp->count < PCP_BATCH && (page = alloc_block(0, &zero)))
+		pcp->pages[pcp->count++] = (void *)((uintptr_t)page |
+						    (zero ? PCP_ZERO : 0));
+	spin_unlock(&lock);
+}
+
+static void *pcp_alloc(struct page_cache *pcp, bool *zero)
+{
+	uintptr_t page;
+
+	if (!pcp->count)
+		pcp_refill(pcp);
+	if (!pcp->count)
+		return NULL;
+
+	page = (uintptr_t)pcp->pages[--pcp->count];
+	*zero = page & PCP_ZERO;
+	return (void *)(page & ~PCP_ZERO);
+}
+
+static void count(struct page_cache *pcp, unsigned long *field,
+		  unsigned long n)
+{
+	if (pcp)
+		*field += n;
+	else
+		atomic_fetch_add(field, n);
+}
+
+#define count_stat(pcp, field, n)					\
+	count(pcp, pcp ? &(pcp)->stats.field : &global_stats.field, n)
+
+/*
+ * Zeroes the freshly allocated block @p, unless @flags says otherwise.
+ * If the pages are already known to be zero only the free list links
+ * need to be cleared.
+ */
+static void prepare_pages(struct page_cache *pcp, void *p,
+			  unsigned long order, unsigned int flags, bool zero)
+{
+	unsigned long i, n = 1ul << order;
+
+	if (flags & ALLOC_NOZERO) {
+		count_stat(pcp, not_zeroed, n);
+	} else if (zero) {
+		for (i = 0; i < n; i++)
+			memset(p + (i << PAGE_SHIFT), 0,
+			       sizeof(struct free_block));
+		count_stat(pcp, prezeroed_used, n);
+	} else {
+		memset(p, 0, PAGE_SIZE << order);
+		count_stat(pcp, zeroed_hot, n);
+	}
+}
+
+void *alloc_page()
+{
+	return alloc_pages_flags(0, 0);
+}
+
+void *alloc_pages(unsigned long order)
+{
+	return alloc_pages_flags(order, 0);
 }
 
 /*
  * Allocates (1 << order) physically contiguous and naturally aligned pages.
  * Returns NULL if there's no memory left.
  */
-void *alloc_pages(unsigned long order)
+void *alloc_pages_flags(unsigned long order, unsigned int flags)
 {
-	/* Generic list traversal. */
-	void *prev;
-	void *curr = NULL;
-	void *next = freelist;
+	struct page_cache *pcp;
+	bool zero = false;
+	void *p;
 
-	/* Looking for a run of length (1 << order). */
-	unsigned long run = 0;
-	const unsigned long n = 1ul << order;
-	const unsigned long align_mask = (n << PAGE_SHIFT) - 1;
-	void *run_start = NULL;
-	void *run_prev = NULL;
-	unsigned long run_next_pa = 0;
-	unsigned long pa;
+	if (order >= NLISTS || !nr_areas)
+		return NULL;
 
-	assert(order < sizeof(unsigned long) * 8);
+	pcp = this_cpu_cache();
+	if (!order && pcp) {
+		p = pcp_alloc(pcp, &zero);
+		goto out;
+	}
 
 	spin_lock(&lock);
-	for (;;) {
-		prev = curr;
-		curr = next;
+	p = alloc_block(order, &zero);
+	spin_unlock(&lock);
 
-		if (!curr) {
-			run_start = NULL;
-			break;
-		}
+	/*
+	 * The pages in our own cache might be what is missing to form a
+	 * large enough block.  The other CPUs' caches can't be touched.
+	 */
+	if (!p && pcp && pcp->count) {
+		pcp_drain(pcp, pcp->count);
+		spin_lock(&lock);
+		p = alloc_block(order, &zero);
+		spin_unlock(&lock);
+	}
 
-		next = *((void **) curr);
-		pa = virt_to_phys(curr);
-
-		if (run == 0) {
-			if (!(pa & align_mask)) {
-				run_start = curr;
-				run_prev = prev;
-				run_next_pa = pa + PAGE_SIZE;
-				run = 1;
-			}
-		} else if (pa == run_next_pa) {
-			run_next_pa += PAGE_SIZE;
-			run += 1;
-		} else {
-			run = 0;
-		}
+out:
+	if (p)
+		prepare_pages(pcp, p, order, flags, zero);
+	return p;
+}
 
-		if (run == n) {
-			if (run_prev)
-				*((void **) run_prev) = next;
-			else
-				freelist = next;
-			break;
-		}
+void free_page(void *page)
+{
+	struct page_cache *pcp = this_cpu_cache();
+
+	if (!pcp || !area_of(page)) {
+		free_pages(page, PAGE_SIZE);
+		return;
 	}
-	spin_unlock(&lock);
-	if (run_start)
-		memset(run_start, 0, n * PAGE_SIZE);
-	return run_start;
-}
 
+	assert_msg((unsigned long) page % PAGE_SIZE == 0,
+		   "page not page aligned: %p", page);
 
-void free_page(void *page)
+	if (pcp->count == PCP_HIGH)
+		pcp_drain(pcp, PCP_BATCH);
+	pcp->pages[pcp->count++] = page;
+}
+
+/*
+ * Zeroes up to @npages free pages that are not known to be zero yet, so
+ * that later allocations don't have to.  Each call continues where the
+ * previous one stopped.  Returns the number of pages zeroed, 0 once all
+ * free pages are zero.  That case doesn't take the lock, so idle CPUs
+ * can poll this cheaply.
+ */
+unsigned long page_alloc_prezero(unsigned long npages)
 {
+	unsigned long done = 0;
+	struct mem_area *a;
+	u8 state;
+	void *p;
+
+	if (READ_ONCE(clean_run) >= READ_ONCE(total_pages))
+		return 0;
+
 	spin_lock(&lock);
-	*(void **)page = freelist;
-	freelist = page;
+	while (done < npages && clean_run < total_pages) {
+		if (zero_area >= nr_areas || zero_idx >= areas[zero_area].npages) {
+			zero_area = (zero_area + 1) % nr_areas;
+			zero_idx = 0;
+		}
+		a = &areas[zero_area];
+		state = a->page_states[zero_idx];
+		p = area_page(a, zero_idx++);
+		clean_run++;
+		if (state & (PAGE_USED | PAGE_ZERO))
+			continue;
+
+		/* Free block heads hold the list links, leave them alone. */
+		if (state & PAGE_FREE)
+			memset(p + sizeof(struct free_block), 0,
+			       PAGE_SIZE - sizeof(struct free_block));
+		else
+			memset(p, 0, PAGE_SIZE);
+		a->page_states[area_idx(a, p)] |= PAGE_ZERO;
+		clean_run = 0;
+
+		/* Don't hog the lock, allocations are more important. */
+		if (++done % PCP_BATCH == 0) {
+			spin_unlock(&lock);
+			spin_lock(&lock);
+		}
+	}
 	spin_unlock(&lock);
+
+	atomic_fetch_add(&global_stats.zeroed_ahead, done);
+	return done;
+}
+
+void page_alloc_get_stats(struct page_alloc_stats *stats)
+{
+	struct page_alloc_stats *s;
+	int i;
+
+	*stats = global_stats;
+	for (i = 0; i < NR_PCP; i++) {
+		s = &page_caches[i].stats;
+		stats->zeroed_hot += s->zeroed_hot;
+		stats->prezeroed_used += s->prezeroed_used;
+		stats->not_zeroed += s->not_zeroed;
+	}
 }
 
 static void *page_memalign(size_t alignment, size_t size)
@@ -162,7 +568,8 @@ static void *page_memalign(size_t alignment, size_t size)
 
 static void page_free(void *mem, size_t size)
 {
-	free_pages(mem, size);
+	/* page_memalign rounded the allocation up to a power of two */
+	free_pages_by_order(mem, get_order(ALIGN(size, PAGE_SIZE) >> PAGE_SHIFT));
 }
 
 static struct alloc_ops page_alloc_ops = {
@@ -8,13 +8,41 @@
 #ifndef ALLOC_PAGE_H
 #define ALLOC_PAGE_H 1
 
+/* Don't zero the pages, the caller overwrites them anyway. */
+#define ALLOC_NOZERO	0x1
+
+struct page_alloc_stats {
+	/* pages zeroed by alloc_pages itself */
+	unsigned long zeroed_hot;
+	/* pages zeroed in advance by page_alloc_prezero */
+	unsigned long zeroed_ahead;
+	/* allocated pages that were already zero */
+	unsigned long prezeroed_used;
+	/* pages allocated with ALLOC_NOZERO */
+	unsigned long not_zeroed;
+};
+
 bool page_alloc_initialized(void);
 void page_alloc_ops_enable(void);
 void *alloc_page(void);
 void *alloc_pages(unsigned long order);
+void *alloc_pages_flags(unsigned long order, unsigned int flags);
 void free_page(void *page);
 void free_pages(void *mem, unsigned long size);
 void free_pages_by_order(void *mem, unsigned long order);
 int get_order(size_t size);
 
+/*
+ * Zeroes up to @npages free pages ahead of time, meant to be called
+ * from an otherwise idle CPU.  Returns the number of pages zeroed.
+ */
+unsigned long page_alloc_prezero(unsigned long npages);
+void page_alloc_get_stats(struct page_alloc_stats *stats);
+
+/*
+ * Implemented by the architecture to enable the per-CPU page caches,
+ * returns a small unique number for the calling CPU.
+ */
+int page_alloc_cpu(void);
+
 #endif
@@ -1,9 +1,21 @@
 #ifndef _ASMARM_SPINLOCK_H_
 #define _ASMARM_SPINLOCK_H_
 
+#include <asm-generic/spinlock-variants.h>
+
+#if defined(CONFIG_SPINLOCK_TICKET)
+struct spinlock {
+	struct ticket_lock l;
+};
+#elif defined(CONFIG_SPINLOCK_MCS)
+struct spinlock {
+	struct mcs_lock l;
+};
+#else
 struct spinlock {
 	int v;
 };
+#endif
 
 extern void spin_lock(struct spinlock *lock);
 extern void spin_unlock(struct spinlock *lock);
@@ -111,8 +111,61 @@ pteval_t *install_page(pgd_t *pgtable, phys_addr_t phys, void *virt)
 				 __pgprot(PTE_WBWA | PTE_USER));
 }
 
+#ifdef __aarch64__
+/* Returns the section entry mapping @vaddr, or NULL if there is none. */
+static pgd_t *get_sect(pgd_t *pgtable, uintptr_t vaddr)
+{
+	pgd_t *pgd = pgd_offset(pgtable, vaddr);
+
+	return pmd_huge(*pmd_offset(pgd, vaddr)) ? pgd : NULL;
+}
+
+/* Sections are top level entries, see mmu_set_range_sect. */
+unsigned long vm_huge_page_sizes(void)
+{
+	return PGDIR_SIZE;
+}
+
+bool install_huge_page(pgd_t *pgtable, phys_addr_t phys, void *virt,
+		       size_t size)
+{
+	if (size != PGDIR_SIZE)
+		return false;
+
+	mmu_set_range_sect(pgtable, (uintptr_t)virt, phys, phys + size,
+			   __pgprot(PMD_ATTRINDX(MT_NORMAL) | PMD_SECT_USER));
+	return true;
+}
+#else
+static pgd_t *get_sect(pgd_t *pgtable, uintptr_t vaddr)
+{
+	return NULL;
+}
+#endif
+
+/* Page table pages are never freed, they are rarely left empty. */
+size_t unmap_page(pgd_t *pgtable, void *virt)
+{
+	pgd_t *sect = get_sect(pgtable, (uintptr_t)virt);
+
+	if (sect) {
+		WRITE_ONCE(*sect, __pgd(0));
+		flush_tlb_page((uintptr_t)virt);
+		return PGDIR_SIZE;
+	}
+
+	install_pte(pgtable, (uintptr_t)virt, 0);
+	return PAGE_SIZE;
+}
+
 phys_addr_t virt_to_pte_phys(pgd_t *pgtable, void *mem)
 {
+	pgd_t *sect = get_sect(pgtable, (uintptr_t)mem);
+
+	if (sect)
+		return (pgd_val(*sect) & PHYS_MASK & PGDIR_MASK)
+			+ ((ulong)mem & ~PGDIR_MASK);
+
 	return (*get_pte(pgtable, (uintptr_t)mem) & PHYS_MASK & -PAGE_SIZE)
 		+ ((ulong)mem & (PAGE_SIZE - 1));
 }
@@ -124,9 +177,24 @@ void mmu_set_range_ptes(pgd_t *pgtable, uintptr_t virt_offset,
 	phys_addr_t paddr = phys_start & PAGE_MASK;
 	uintptr_t vaddr = virt_offset & PAGE_MASK;
 	uintptr_t virt_end = phys_end - paddr + vaddr;
+	pteval_t *p_pte = NULL;
+
+	for (; vaddr < virt_end; vaddr += PAGE_SIZE, paddr += PAGE_SIZE) {
+		/* only walk the tables for the first entry of each table */
+		if (!p_pte || !pte_index(vaddr))
+			p_pte = get_pte(pgtable, vaddr);
+		else
+			p_pte++;
+		WRITE_ONCE(*p_pte, paddr | PTE_TYPE_PAGE | PTE_AF |
+				   PTE_SHARED | pgprot_val(prot));
+	}
+	flush_tlb_all();
+}
 
-	for (; vaddr < virt_end; vaddr += PAGE_SIZE, paddr += PAGE_SIZE)
-		install_page_prot(pgtable, paddr, vaddr, prot);
+void install_pages(pgd_t *pgtable, phys_addr_t phys, size_t len, void *virt)
+{
+	mmu_set_range_ptes(pgtable, (uintptr_t)virt, phys, phys + len,
+			   __pgprot(PTE_WBWA | PTE_USER));
 }
 
 void mmu_set_range_sect(pgd_t *pgtable, uintptr_t virt_offset,
@@ -7,6 +7,8 @@
  */
 #include <libcflat.h>
 #include <auxinfo.h>
+#include <alloc_page.h>
+#include <work_queue.h>
 #include <asm/thread_info.h>
 #include <asm/spinlock.h>
 #include <asm/cpumask.h>
@@ -86,6 +88,7 @@ struct on_cpu_info {
 	cpumask_t waiters;
 };
 static struct on_cpu_info on_cpu_info[NR_CPUS];
+static struct work_queue work_queues[NR_CPUS];
 
 static void __deadlock_check(int cpu, const cpumask_t *waiters, bool *found)
 {
@@ -130,6 +133,11 @@ static void cpu_wait(int cpu)
 	cpumask_clear_cpu(me, &on_cpu_info[cpu].waiters);
 }
 
+int page_alloc_cpu(void)
+{
+	return smp_processor_id();
+}
+
 void do_idle(void)
 {
 	int cpu = smp_processor_id();
@@ -141,14 +149,17 @@ void do_idle(void)
 	sev();
 
 	for (;;) {
-		while (cpu_idle(cpu))
+		while (cpu_idle(cpu) && work_queue_empty(&work_queues[cpu]))
 			wfe();
 		smp_rmb();
-		on_cpu_info[cpu].func(on_cpu_info[cpu].data);
-		on_cpu_info[cpu].func = NULL;
-		smp_wmb();
-		set_cpu_idle(cpu, true);
-		sev();
+		if (!cpu_idle(cpu)) {
+			on_cpu_info[cpu].func(on_cpu_info[cpu].data);
+			on_cpu_info[cpu].func = NULL;
+			smp_wmb();
+			set_cpu_idle(cpu, true);
+			sev();
+		}
+		work_queue_run(&work_queues[cpu]);
 	}
 }
 
@@ -181,6 +192,33 @@ void on_cpu_async(int cpu, void (*func)(void *data), void *data)
 	sev();
 }
 
+/*
+ * The jobs are run by @cpu's idle loop, in between on_cpu() calls.
+ */
+void queue_work(int cpu, void (*func)(void *data), void *data,
+		struct completion *done)
+{
+	if (cpu == smp_processor_id()) {
+		func(data);
+		return;
+	}
+
+	assert_msg(cpu != 0 || cpu0_calls_idle, "Queueing work on CPU0, which is unlikely to idle. "
+						"If this is intended set cpu0_calls_idle=1");
+
+	if (!cpu_online(cpu)) {
+		spin_lock(&lock);
+		if (!cpu_online(cpu))
+			__smp_boot_secondary(cpu, do_idle);
+		spin_unlock(&lock);
+	}
+
+	while (!work_queue_push(&work_queues[cpu], func, data, done))
+		cpu_relax();
+	dsb(ishst);
+	sev();
+}
+
 void on_cpu(int cpu, void (*func)(void *data), void *data)
 {
 	on_cpu_async(cpu, func, data);
@@ -10,6 +10,7 @@
 #include <asm/barrier.h>
 #include <asm/mmu.h>
 
+#if !defined(CONFIG_SPINLOCK_TICKET) && !defined(CONFIG_SPINLOCK_MCS)
 void spin_lock(struct spinlock *lock)
 {
 	u32 val, fail;
@@ -41,3 +42,47 @@ void spin_unlock(struct spinlock *lock)
 	else
 		lock->v = 0;
 }
+
+#else
+/*
+ * Exclusive accesses need the MMU, until it is on only one CPU runs and
+ * the lock is taken without atomics.
+ */
+void spin_lock(struct spinlock *lock)
+{
+	if (!mmu_enabled()) {
+#ifdef CONFIG_SPINLOCK_TICKET
+		lock->l.next++;
+#else
+		lock->l.locked = 1;
+#endif
+		smp_mb();
+		return;
+	}
+
+#ifdef CONFIG_SPINLOCK_TICKET
+	ticket_spin_lock(&lock->l);
+#else
+	mcs_spin_lock(&lock->l);
+#endif
+}
+
+void spin_unlock(struct spinlock *lock)
+{
+	if (!mmu_enabled()) {
+		smp_mb();
+#ifdef CONFIG_SPINLOCK_TICKET
+		lock->l.owner++;
+#else
+		lock->l.locked = 0;
+#endif
+		return;
+	}
+
+#ifdef CONFIG_SPINLOCK_TICKET
+	ticket_spin_unlock(&lock->l);
+#else
+	mcs_spin_unlock(&lock->l);
+#endif
+}
+#endif
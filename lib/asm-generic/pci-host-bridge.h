@@ -9,6 +9,9 @@
 
 phys_addr_t pci_host_bridge_get_paddr(uint64_t addr);
 
+/* Config space can only be accessed once pci_probe() found the bridge. */
+bool pci_available(void);
+
 static inline
 phys_addr_t pci_translate_addr(pcidevaddr_t dev __unused, uint64_t addr)
 {
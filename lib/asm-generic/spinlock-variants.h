@@ -0,0 +1,105 @@
+#ifndef _ASM_GENERIC_SPINLOCK_VARIANTS_H_
+#define _ASM_GENERIC_SPINLOCK_VARIANTS_H_
+/*
+ * Spinlock algorithms built on the __sync builtins.  struct spinlock is
+ * one of them, chosen with configure --spinlock; all of them are
+ * available by name so that they can be compared in one test.
+ *
+ * tas:    test-and-test-and-set.  Cheapest when uncontended, but unfair,
+ *         and every release makes all waiters race for the lock line.
+ * ticket: waiters are served in FIFO order, but they all poll the same
+ *         owner field.
+ * mcs:    FIFO queue of waiters, each spinning on a node on its own
+ *         stack.  As in Linux's qspinlock, only the head of the queue
+ *         polls the lock word, and the node is no longer used once the
+ *         lock is taken, so no per-CPU state is needed.
+ *
+ * All are zero-initialized.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.
+ */
+#include <stddef.h>
+#include <asm/barrier.h>
+
+struct tas_lock {
+	volatile unsigned int v;
+};
+
+struct ticket_lock {
+	volatile unsigned int next;
+	volatile unsigned int owner;
+};
+
+struct mcs_node {
+	struct mcs_node *volatile next;
+	volatile int wait;
+};
+
+struct mcs_lock {
+	volatile unsigned int locked;
+	struct mcs_node *volatile tail;
+};
+
+static inline void tas_spin_lock(struct tas_lock *lock)
+{
+	while (__sync_lock_test_and_set(&lock->v, 1))
+		while (lock->v)
+			cpu_relax();
+}
+
+static inline void tas_spin_unlock(struct tas_lock *lock)
+{
+	__sync_lock_release(&lock->v);
+}
+
+static inline void ticket_spin_lock(struct ticket_lock *lock)
+{
+	unsigned int ticket = __sync_fetch_and_add(&lock->next, 1);
+
+	while (lock->owner != ticket)
+		cpu_relax();
+	smp_rmb();
+}
+
+static inline void ticket_spin_unlock(struct ticket_lock *lock)
+{
+	__sync_fetch_and_add(&lock->owner, 1);
+}
+
+static inline void mcs_spin_lock(struct mcs_lock *lock)
+{
+	struct mcs_node node = { .next = NULL, .wait = 1 }, *prev;
+
+	if (!lock->tail && __sync_bool_compare_and_swap(&lock->locked, 0, 1))
+		return;
+
+	prev = __sync_lock_test_and_set(&lock->tail, &node);
+	if (prev) {
+		smp_wmb();
+		prev->next = &node;
+		while (node.wait)
+			cpu_relax();
+		smp_rmb();
+	}
+
+	/* Head of the queue, wait for the owner to go. */
+	while (lock->locked || !__sync_bool_compare_and_swap(&lock->locked, 0, 1))
+		cpu_relax();
+
+	if (lock->tail == &node &&
+	    __sync_bool_compare_and_swap(&lock->tail, &node, NULL))
+		return;
+
+	/* Someone queued behind us, make them the head. */
+	while (!node.next)
+		cpu_relax();
+	smp_wmb();
+	node.next->wait = 0;
+}
+
+static inline void mcs_spin_unlock(struct mcs_lock *lock)
+{
+	__sync_lock_release(&lock->locked);
+}
+
+#endif
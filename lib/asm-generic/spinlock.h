@@ -1,18 +1,50 @@
 #ifndef _ASM_GENERIC_SPINLOCK_H_
 #define _ASM_GENERIC_SPINLOCK_H_
 
+#include <asm-generic/spinlock-variants.h>
+
+#if defined(CONFIG_SPINLOCK_TICKET)
+struct spinlock {
+	struct ticket_lock l;
+};
+
+static inline void spin_lock(struct spinlock *lock)
+{
+	ticket_spin_lock(&lock->l);
+}
+
+static inline void spin_unlock(struct spinlock *lock)
+{
+	ticket_spin_unlock(&lock->l);
+}
+#elif defined(CONFIG_SPINLOCK_MCS)
 struct spinlock {
-    unsigned int v;
+	struct mcs_lock l;
 };
 
 static inline void spin_lock(struct spinlock *lock)
 {
-	while (__sync_lock_test_and_set(&lock->v, 1));
+	mcs_spin_lock(&lock->l);
 }
 
 static inline void spin_unlock(struct spinlock *lock)
 {
-	__sync_lock_release(&lock->v);
+	mcs_spin_unlock(&lock->l);
 }
+#else
+struct spinlock {
+	struct tas_lock l;
+};
+
+static inline void spin_lock(struct spinlock *lock)
+{
+	tas_spin_lock(&lock->l);
+}
+
+static inline void spin_unlock(struct spinlock *lock)
+{
+	tas_spin_unlock(&lock->l);
+}
+#endif
 
 #endif
@@ -0,0 +1,167 @@
+/*
+ * Machine readable benchmark records
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.
+ */
+#include <libcflat.h>
+#include "bench.h"
+
+static void sift_down(u64 *v, unsigned long root, unsigned long n)
+{
+	unsigned long child;
+	u64 tmp;
+
+	while ((child = 2 * root + 1) < n) {
+		if (child + 1 < n && v[child] < v[child + 1])
+			child++;
+		if (v[root] >= v[child])
+			return;
+		tmp = v[root];
+		v[root] = v[child];
+		v[child] = tmp;
+		root = child;
+	}
+}
+
+/* Heapsort, sample arrays can be too big for a recursive sort. */
+void bench_sort(u64 *v, unsigned long n)
+{
+	unsigned long i;
+	u64 tmp;
+
+	for (i = n / 2; i-- > 0; )
+		sift_down(v, i, n);
+
+	for (i = n; i-- > 1; ) {
+		tmp = v[0];
+		v[0] = v[i];
+		v[i] = tmp;
+		sift_down(v, 0, i);
+	}
+}
+
+u64 bench_percentile(const u64 *sorted, unsigned long n,
+		     unsigned int permille)
+{
+	unsigned long rank = (n * permille + 999) / 1000;
+
+	return sorted[rank ? rank - 1 : 0];
+}
+
+static u64 isqrt(u64 x)
+{
+	u64 r = 0, bit = 1ull << 62;
+
+	while (bit > x)
+		bit >>= 2;
+
+	while (bit) {
+		if (x >= r + bit) {
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		} else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return r;
+}
+
+/*
+ * The squared deviations are added up in 128 bits, a single sample 2^32
+ * cycles off the mean, e.g. a preempted vCPU, already overflows a u64.
+ * Not __int128, which 32-bit targets do not have.
+ */
+struct u128 {
+	u64 hi, lo;
+};
+
+static void add_square(struct u128 *acc, u64 d)
+{
+	u64 a = d >> 32, b = d & 0xffffffffull, mid = a * b;
+	u64 lo = b * b;
+
+	acc->hi += a * a + (mid >> 31);
+	if (lo + (mid << 33) < lo)
+		acc->hi++;
+	lo += mid << 33;
+	if (acc->lo + lo < acc->lo)
+		acc->hi++;
+	acc->lo += lo;
+}
+
+/* @x / @n, saturated if the quotient does not fit in 64 bits. */
+static u64 div_u128(struct u128 x, u64 n)
+{
+	u64 rem = x.hi, q = 0, top;
+	int i;
+
+	if (x.hi >= n)
+		return ~0ull;
+
+	for (i = 63; i >= 0; i--) {
+		top = rem >> 63;
+		rem = (rem << 1) | ((x.lo >> i) & 1);
+		if (top || rem >= n) {
+			rem -= n;
+			q |= 1ull << i;
+		}
+	}
+	return q;
+}
+
+void bench_stats_compute(struct bench_stats *stats, u64 *samples,
+			 unsigned long n)
+{
+	struct u128 var = { 0, 0 };
+	u64 sum = 0, d;
+	unsigned long i;
+
+	assert(n);
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < n; ++i)
+		sum += samples[i];
+	stats->samples = n;
+	stats->mean = sum / n;
+
+	for (i = 0; i < n; ++i) {
+		d = samples[i] > stats->mean ? samples[i] - stats->mean
+					     : stats->mean - samples[i];
+		add_square(&var, d);
+	}
+	stats->stddev = isqrt(div_u128(var, n));
+
+	bench_sort(samples, n);
+	stats->min = samples[0];
+	stats->p50 = bench_percentile(samples, n, 500);
+	stats->p90 = bench_percentile(samples, n, 900);
+	stats->p99 = bench_percentile(samples, n, 990);
+	stats->p999 = bench_percentile(samples, n, 999);
+	stats->max = samples[n - 1];
+	stats->has_dist = true;
+}
+
+void bench_stats_mean(struct bench_stats *stats, u64 total,
+		      unsigned long samples)
+{
+	assert(samples);
+	memset(stats, 0, sizeof(*stats));
+	stats->samples = samples;
+	stats->mean = total / samples;
+}
+
+void bench_report(const char *name, const char *unit,
+		  const struct bench_stats *stats)
+{
+	printf("BENCH: name=%s unit=%s samples=%lu mean=%" PRIu64,
+	       name, unit, stats->samples, stats->mean);
+
+	if (stats->has_dist)
+		printf(" stddev=%" PRIu64 " min=%" PRIu64 " p50=%" PRIu64
+		       " p90=%" PRIu64 " p99=%" PRIu64 " p99.9=%" PRIu64
+		       " max=%" PRIu64, stats->stddev, stats->min, stats->p50,
+		       stats->p90, stats->p99, stats->p999, stats->max);
+
+	printf("\n");
+}
@@ -0,0 +1,69 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+/*
+ * Machine readable benchmark records shared by the benchmark tests.
+ *
+ * Each result is printed as a single line of the form
+ *
+ *   BENCH: name=<name> unit=<unit> samples=<n> mean=<v> [stddev=<v>
+ *          min=<v> p50=<v> p90=<v> p99=<v> p99.9=<v> max=<v>]
+ *
+ * where all values are unsigned integers in <unit>.  The distribution
+ * fields are only present when the individual samples are known, tests
+ * which only measure a total over all iterations report the mean alone.
+ * Lower is better, except for units that run_tests.sh lists in
+ * BENCH_HIGHER_UNITS, such as iops, pps and permille.
+ * run_tests.sh collects these lines from all test logs into a single
+ * results file, see scripts/runtime.bash.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.
+ */
+#include <libcflat.h>
+
+struct bench_stats {
+	unsigned long samples;
+	u64 mean;
+	bool has_dist;
+	/* only valid if has_dist is set */
+	u64 stddev;
+	u64 min;
+	u64 p50;
+	u64 p90;
+	u64 p99;
+	u64 p999;
+	u64 max;
+};
+
+/*
+ * bench_sort sorts @n samples in place, in ascending order.
+ */
+extern void bench_sort(u64 *samples, unsigned long n);
+
+/*
+ * bench_percentile returns the nearest-rank percentile of an array
+ * sorted with bench_sort, @permille is between 0 and 1000.
+ */
+extern u64 bench_percentile(const u64 *sorted, unsigned long n,
+			    unsigned int permille);
+
+/*
+ * bench_stats_compute fills @stats from @n individual samples.
+ * @samples is sorted in place.
+ */
+extern void bench_stats_compute(struct bench_stats *stats, u64 *samples,
+				unsigned long n);
+
+/*
+ * bench_stats_mean fills @stats for a test which only knows the @total
+ * over @samples iterations.
+ */
+extern void bench_stats_mean(struct bench_stats *stats, u64 total,
+			     unsigned long samples);
+
+/*
+ * bench_report prints @stats as a BENCH: record for test @name.
+ */
+extern void bench_report(const char *name, const char *unit,
+			 const struct bench_stats *stats);
+
+#endif
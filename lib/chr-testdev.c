@@ -6,6 +6,7 @@
 #include "libcflat.h"
 #include "virtio.h"
 #include "asm/spinlock.h"
+#include "asm/barrier.h"
 
 #include "chr-testdev.h"
 
@@ -26,7 +27,7 @@ static void __testdev_send(char *buf, unsigned int len)
 		return;
 
 	while (!virtqueue_get_buf(out_vq, &len))
-		;
+		cpu_relax();
 }
 
 void chr_testdev_exit(int code)
@@ -60,6 +61,7 @@ void chr_testdev_init(void)
 		return;
 	}
 
+	virtio_negotiate_features(vcon, 1ull << VIRTIO_RING_F_EVENT_IDX);
 	ret = vcon->config->find_vqs(vcon, 2, vqs, NULL, io_names);
 	if (ret < 0) {
 		printf("%s: %s: can't init virtqueues\n",
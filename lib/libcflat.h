@@ -35,6 +35,7 @@
 #define __ALIGN(x, a)		__ALIGN_MASK(x, (typeof(x))(a) - 1)
 #define ALIGN(x, a)		__ALIGN((x), (a))
 #define IS_ALIGNED(x, a)	(((x) & ((typeof(x))(a) - 1)) == 0)
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
 
 #define SZ_256			(1 << 8)
 #define SZ_4K			(1 << 12)
@@ -114,6 +115,7 @@ extern void report_skip(const char *msg_fmt, ...)
 extern void report_info(const char *msg_fmt, ...)
 					__attribute__((format(printf, 1, 2)));
 extern void report_pass(void);
+extern void report_set_verbosity(int level);
 extern int report_summary(void);
 
 bool simple_glob(const char *text, const char *pattern);
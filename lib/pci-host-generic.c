@@ -256,6 +256,11 @@ bool pci_probe(void)
 	return true;
 }
 
+bool pci_available(void)
+{
+	return pci_host_bridge != NULL;
+}
+
 /*
  * This function is to be called from pci_translate_addr() to provide
  * mapping between this host bridge's PCI busses address and CPU physical
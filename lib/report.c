@@ -13,17 +13,103 @@
 #include "libcflat.h"
 #include "asm/spinlock.h"
 
-static unsigned int tests, failures, xfailures, skipped;
 static char prefixes[256];
 static struct spinlock lock;
 
 #define PREFIX_DELIMITER ": "
 
+/*
+ * Results are counted per CPU and summed up by report_summary(), so
+ * reporting from many CPUs does not bounce one cache line around.  CPUs
+ * past NR_REPORT_CPUS, or all of them if the CPU number is not known,
+ * share the last slot, which is why the counters are still atomic.
+ */
+#define NR_REPORT_CPUS	64
+
+struct report_counters {
+	unsigned int tests, failures, xfailures, skipped;
+} __attribute__((aligned(64)));
+
+static struct report_counters counters[NR_REPORT_CPUS];
+
+/* Only present if the page allocator is linked in. */
+extern int page_alloc_cpu(void) __attribute__((__weak__));
+
+static struct report_counters *cpu_counters(void)
+{
+	int cpu = page_alloc_cpu ? page_alloc_cpu() : -1;
+
+	if (cpu < 0 || cpu >= NR_REPORT_CPUS)
+		cpu = NR_REPORT_CPUS - 1;
+	return &counters[cpu];
+}
+
+#define count(c, field)	__sync_fetch_and_add(&(c)->field, 1)
+
+/*
+ * The verbosity is taken from REPORT_VERBOSITY in the environment unless
+ * set with report_set_verbosity():
+ *
+ *   2 (default) prints every result as it is reported.
+ *   1 keeps the last REPORT_RING_LINES PASS lines in memory and prints
+ *     them only before a failure, to give it some context.
+ *   0 only counts PASS results.
+ *
+ * Anything but a PASS, and the summary, is always printed.
+ */
+#define REPORT_RING_LINES	32
+#define REPORT_LINE_SIZE	160
+
+static int verbosity = -1;
+static char ring[REPORT_RING_LINES][REPORT_LINE_SIZE];
+static unsigned int ring_head, ring_count;
+
+void report_set_verbosity(int level)
+{
+	verbosity = level;
+}
+
+static int report_verbosity(void)
+{
+	char *s;
+
+	if (verbosity < 0) {
+		s = getenv("REPORT_VERBOSITY");
+		verbosity = s && *s ? atol(s) : 2;
+	}
+	return verbosity;
+}
+
+/* Called with the lock held. */
+static void ring_add(const char *msg_fmt, va_list va)
+{
+	char *line = ring[ring_head];
+	int len;
+
+	len = snprintf(line, REPORT_LINE_SIZE, "PASS: %s", prefixes);
+	if (len < REPORT_LINE_SIZE)
+		vsnprintf(line + len, REPORT_LINE_SIZE - len, msg_fmt, va);
+
+	ring_head = (ring_head + 1) % REPORT_RING_LINES;
+	if (ring_count < REPORT_RING_LINES)
+		ring_count++;
+}
+
+/* Called with the lock held. */
+static void ring_flush(void)
+{
+	unsigned int i = (ring_head + REPORT_RING_LINES - ring_count) %
+			 REPORT_RING_LINES;
+
+	for (; ring_count; ring_count--, i = (i + 1) % REPORT_RING_LINES) {
+		puts(ring[i]);
+		puts("\n");
+	}
+}
+
 void report_pass(void)
 {
-	spin_lock(&lock);
-	tests++;
-	spin_unlock(&lock);
+	count(cpu_counters(), tests);
 }
 
 void report_prefix_pushf(const char *prefix_fmt, ...)
@@ -86,20 +172,34 @@ static void va_report(const char *msg_fmt,
 	const char *prefix = skip ? "SKIP"
 				  : xfail ? (pass ? "XPASS" : "XFAIL")
 					  : (pass ? "PASS"  : "FAIL");
+	struct report_counters *c = cpu_counters();
+	bool failed = !skip && (xfail || !pass);
+
+	count(c, tests);
+	if (skip)
+		count(c, skipped);
+	else if (xfail && !pass)
+		count(c, xfailures);
+	else if (failed)
+		count(c, failures);
+
+	if (!skip && !xfail && pass && report_verbosity() < 2) {
+		if (report_verbosity() == 1) {
+			spin_lock(&lock);
+			ring_add(msg_fmt, va);
+			spin_unlock(&lock);
+		}
+		return;
+	}
 
 	spin_lock(&lock);
 
-	tests++;
+	if (failed)
+		ring_flush();
 	printf("%s: ", prefix);
 	puts(prefixes);
 	vprintf(msg_fmt, va);
 	puts("\n");
-	if (skip)
-		skipped++;
-	else if (xfail && !pass)
-		xfailures++;
-	else if (xfail || !pass)
-		failures++;
 
 	spin_unlock(&lock);
 }
@@ -144,7 +244,16 @@ void report_info(const char *msg_fmt, ...)
 
 int report_summary(void)
 {
-	int ret;
+	unsigned int tests = 0, failures = 0, xfailures = 0, skipped = 0;
+	int i, ret;
+
+	for (i = 0; i < NR_REPORT_CPUS; i++) {
+		tests += counters[i].tests;
+		failures += counters[i].failures;
+		xfailures += counters[i].xfailures;
+		skipped += counters[i].skipped;
+	}
+
 	spin_lock(&lock);
 
 	printf("SUMMARY: %d tests", tests);
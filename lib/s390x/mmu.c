@@ -82,6 +82,12 @@ pteval_t *install_page(pgd_t *pgtable, phys_addr_t phys, void *vaddr)
 	return set_pte(pgtable, __pa(phys), vaddr);
 }
 
+size_t unmap_page(pgd_t *pgtable, void *vaddr)
+{
+	set_pte(pgtable, PAGE_ENTRY_I, vaddr);
+	return PAGE_SIZE;
+}
+
 void protect_page(void *vaddr, unsigned long prot)
 {
 	pteval_t *p_pte = get_pte(table_root, (uintptr_t)vaddr);
@@ -116,19 +122,30 @@ void unprotect_range(void *start, unsigned long len, unsigned long prot)
 		unprotect_page((void *)curr, prot);
 }
 
+void install_pages(pgd_t *pgtable, phys_addr_t phys, size_t len, void *vaddr)
+{
+	uintptr_t virt = (uintptr_t)vaddr;
+	pteval_t *p_pte = NULL;
+
+	for (; len; len -= PAGE_SIZE, virt += PAGE_SIZE, phys += PAGE_SIZE) {
+		/* only walk the tables for the first entry of each table */
+		if (!p_pte || !pte_index(virt))
+			p_pte = get_pte(pgtable, virt);
+		else
+			p_pte++;
+		if (!(*p_pte & PAGE_ENTRY_I))
+			ipte(virt, p_pte);
+		*p_pte = __pa(phys);
+	}
+}
+
+/* @end_addr may wrap around to 0 */
 static void setup_identity(pgd_t *pgtable, phys_addr_t start_addr,
 			   phys_addr_t end_addr)
 {
-	phys_addr_t cur;
-
 	start_addr &= PAGE_MASK;
-	for (cur = start_addr; true; cur += PAGE_SIZE) {
-		if (start_addr < end_addr && cur >= end_addr)
-			break;
-		if (start_addr > end_addr && cur <= end_addr)
-			break;
-		install_page(pgtable, cur, __va(cur));
-	}
+	install_pages(pgtable, start_addr,
+		      ALIGN(end_addr - start_addr, PAGE_SIZE), __va(start_addr));
 }
 
 void *setup_mmu(phys_addr_t phys_end){
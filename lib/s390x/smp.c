@@ -32,6 +32,11 @@ static struct spinlock lock;
 
 extern void smp_cpu_setup_state(void);
 
+int page_alloc_cpu(void)
+{
+	return stap();
+}
+
 int smp_query_num_cpus(void)
 {
 	struct ReadCpuInfo *info = (void *)cpu_info_buffer;
@@ -0,0 +1,115 @@
+/*
+ * Barriers for a fixed set of CPUs, see smp_barrier.h
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.
+ */
+#include <libcflat.h>
+#include <linux/compiler.h>
+#include <asm/barrier.h>
+#include <alloc.h>
+#include "smp_barrier.h"
+
+#define MAX_ROUNDS	16
+
+/*
+ * Dissemination barriers alternate between two sets of flags so that a
+ * fast CPU signalling for the next episode cannot clobber a flag its
+ * partner has not seen yet, and flip @sense every other episode so the
+ * flags never need to be cleared.
+ */
+struct dissem_node {
+	volatile unsigned int flags[2][MAX_ROUNDS];
+	unsigned int parity;
+	unsigned int sense;
+} __attribute__((aligned(64)));
+
+void smp_barrier_init(struct smp_barrier *b, enum smp_barrier_type type,
+		      int nr)
+{
+	int i;
+
+	assert(nr > 0);
+	memset(b, 0, sizeof(*b));
+	b->type = type;
+	b->nr = nr;
+
+	if (type != SMP_BARRIER_DISSEMINATION)
+		return;
+
+	while ((1 << b->rounds) < nr)
+		b->rounds++;
+	assert(b->rounds <= MAX_ROUNDS);
+
+	b->nodes = memalign(__alignof__(struct dissem_node),
+			    nr * sizeof(struct dissem_node));
+	assert(b->nodes);
+	memset(b->nodes, 0, nr * sizeof(struct dissem_node));
+	for (i = 0; i < nr; i++)
+		b->nodes[i].sense = 1;
+	smp_wmb();
+}
+
+void smp_barrier_destroy(struct smp_barrier *b)
+{
+	free(b->nodes);
+	b->nodes = NULL;
+}
+
+static void central_wait(struct smp_barrier *b)
+{
+	/* gen cannot move on before this CPU has arrived. */
+	unsigned int gen = b->gen;
+
+	if (__sync_add_and_fetch(&b->count, 1) == b->nr) {
+		b->count = 0;
+		smp_wmb();
+		b->gen = gen + 1;
+		return;
+	}
+
+	while (b->gen == gen)
+		cpu_relax();
+	smp_rmb();
+}
+
+static void dissem_wait(struct smp_barrier *b, int cpu)
+{
+	struct dissem_node *me = &b->nodes[cpu];
+	unsigned int parity = me->parity, sense = me->sense;
+	int k;
+
+	for (k = 0; k < b->rounds; k++) {
+		struct dissem_node *partner = &b->nodes[(cpu + (1 << k)) % b->nr];
+
+		smp_mb();
+		partner->flags[parity][k] = sense;
+		while (me->flags[parity][k] != sense)
+			cpu_relax();
+	}
+	smp_mb();
+
+	if (parity)
+		me->sense = !sense;
+	me->parity = !parity;
+}
+
+void smp_barrier_wait(struct smp_barrier *b, int cpu)
+{
+	assert(cpu >= 0 && cpu < b->nr);
+
+	if (b->type == SMP_BARRIER_DISSEMINATION)
+		dissem_wait(b, cpu);
+	else
+		central_wait(b);
+}
+
+const char *smp_barrier_name(enum smp_barrier_type type)
+{
+	switch (type) {
+	case SMP_BARRIER_CENTRAL:
+		return "central";
+	case SMP_BARRIER_DISSEMINATION:
+		return "dissemination";
+	}
+	return "unknown";
+}
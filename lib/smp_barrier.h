@@ -0,0 +1,56 @@
+#ifndef _SMP_BARRIER_H_
+#define _SMP_BARRIER_H_
+/*
+ * Barriers for a fixed set of CPUs
+ *
+ * SMP_BARRIER_CENTRAL is a sense-reversing barrier: every CPU increments
+ * a shared counter and waits for the last one to flip the generation.
+ * It is cheap for a few CPUs, but all of them hit the same two cache
+ * lines.
+ *
+ * SMP_BARRIER_DISSEMINATION takes log2(nr) rounds.  In round k, CPU i
+ * signals CPU (i + 2^k) % nr and waits for CPU (i - 2^k) % nr, each CPU
+ * spinning on its own cache line only.
+ *
+ * Both kinds can be reused immediately, there is no reset between
+ * episodes.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.
+ */
+#include <libcflat.h>
+
+enum smp_barrier_type {
+	SMP_BARRIER_CENTRAL,
+	SMP_BARRIER_DISSEMINATION,
+};
+
+struct dissem_node;
+
+struct smp_barrier {
+	enum smp_barrier_type type;
+	int nr;
+	int rounds;
+	struct dissem_node *nodes;
+	volatile unsigned int count __attribute__((aligned(64)));
+	volatile unsigned int gen __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+/*
+ * smp_barrier_init prepares @b for @nr CPUs.  A dissemination barrier
+ * allocates its per-CPU state with malloc(), release it with
+ * smp_barrier_destroy.
+ */
+extern void smp_barrier_init(struct smp_barrier *b, enum smp_barrier_type type,
+			     int nr);
+extern void smp_barrier_destroy(struct smp_barrier *b);
+
+/*
+ * smp_barrier_wait returns once all @nr CPUs have called it.  @cpu is
+ * the caller's index among them, from 0 to @nr - 1, and must be stable
+ * across episodes.
+ */
+extern void smp_barrier_wait(struct smp_barrier *b, int cpu);
+
+extern const char *smp_barrier_name(enum smp_barrier_type type);
+
+#endif
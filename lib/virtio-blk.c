@@ -0,0 +1,89 @@
+/*
+ * A minimal polled virtio-blk driver, see virtio-blk.h
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+#include "libcflat.h"
+#include "alloc_page.h"
+#include "asm/page.h"
+#include "asm/io.h"
+#include "virtio.h"
+#include "virtio-blk.h"
+
+bool virtio_blk_init(struct virtio_blk *blk, u64 features)
+{
+	struct virtio_device *vdev;
+	int ret;
+
+	memset(blk, 0, sizeof(*blk));
+
+	vdev = virtio_bind(VIRTIO_ID_BLOCK);
+	if (!vdev)
+		return false;
+
+	virtio_negotiate_features(vdev, features |
+				  (1ull << VIRTIO_BLK_F_MQ) |
+				  (1ull << VIRTIO_BLK_F_BLK_SIZE));
+
+	blk->vdev = vdev;
+	blk->capacity = virtio_config_readl(vdev, VIRTIO_BLK_CFG_CAPACITY) |
+		(u64)virtio_config_readl(vdev, VIRTIO_BLK_CFG_CAPACITY + 4) << 32;
+	blk->blk_size = VIRTIO_BLK_SECTOR_SIZE;
+	if (virtio_has_feature(vdev, VIRTIO_BLK_F_BLK_SIZE))
+		blk->blk_size = virtio_config_readl(vdev, VIRTIO_BLK_CFG_BLK_SIZE);
+	blk->nr_queues = 1;
+	if (virtio_has_feature(vdev, VIRTIO_BLK_F_MQ))
+		blk->nr_queues = virtio_config_readw(vdev,
+						     VIRTIO_BLK_CFG_NUM_QUEUES);
+	blk->nr_queues = MIN(blk->nr_queues, VIRTIO_BLK_MAX_QUEUES);
+
+	ret = vdev->config->find_vqs(vdev, blk->nr_queues, blk->vqs,
+				     NULL, NULL);
+	assert(ret == 0);
+
+	return true;
+}
+
+struct virtio_blk_req *virtio_blk_alloc_reqs(unsigned int nr)
+{
+	size_t size = ALIGN(nr * sizeof(struct virtio_blk_req), PAGE_SIZE);
+
+	return alloc_pages(get_order(size >> PAGE_SHIFT));
+}
+
+int virtio_blk_queue(struct virtio_blk *blk, unsigned int q,
+		     struct virtio_blk_req *req, u32 type, u64 sector,
+		     void *buf, unsigned int len)
+{
+	struct virtio_buf bufs[3] = {
+		{ &req->hdr, sizeof(req->hdr) },
+		{ buf, len },
+		{ &req->status, sizeof(req->status) },
+	};
+
+	assert(q < blk->nr_queues);
+	assert(type == VIRTIO_BLK_T_IN || type == VIRTIO_BLK_T_OUT);
+
+	req->hdr.type = type;
+	req->hdr.ioprio = 0;
+	req->hdr.sector = sector;
+	req->status = 0xff;
+
+	/* Reads have the data buffer written by the device. */
+	if (type == VIRTIO_BLK_T_IN)
+		return virtqueue_add(blk->vqs[q], bufs, 1, 2, req);
+	return virtqueue_add(blk->vqs[q], bufs, 2, 1, req);
+}
+
+void virtio_blk_kick(struct virtio_blk *blk, unsigned int q)
+{
+	virtqueue_kick(blk->vqs[q]);
+}
+
+struct virtio_blk_req *virtio_blk_get_req(struct virtio_blk *blk,
+					  unsigned int q)
+{
+	unsigned int len;
+
+	return virtqueue_get_buf(blk->vqs[q], &len);
+}
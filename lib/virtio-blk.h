@@ -0,0 +1,83 @@
+#ifndef _VIRTIO_BLK_H_
+#define _VIRTIO_BLK_H_
+/*
+ * A minimal polled virtio-blk driver.
+ *
+ * Every virtqueue is meant to be used by a single CPU, there is no
+ * locking.  Requests and data buffers are handed to the device by
+ * physical address, so they must be physically contiguous and have
+ * virt_to_phys() work on them, e.g. come from alloc_pages().
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+#include "libcflat.h"
+#include "virtio.h"
+
+#define VIRTIO_BLK_F_BLK_SIZE	6
+#define VIRTIO_BLK_F_MQ		12
+
+/* struct virtio_blk_config */
+#define VIRTIO_BLK_CFG_CAPACITY		0
+#define VIRTIO_BLK_CFG_BLK_SIZE		20
+#define VIRTIO_BLK_CFG_NUM_QUEUES	34
+
+#define VIRTIO_BLK_T_IN		0
+#define VIRTIO_BLK_T_OUT	1
+
+#define VIRTIO_BLK_S_OK		0
+#define VIRTIO_BLK_S_IOERR	1
+#define VIRTIO_BLK_S_UNSUPP	2
+
+#define VIRTIO_BLK_SECTOR_SIZE	512
+#define VIRTIO_BLK_MAX_QUEUES	16
+
+struct virtio_blk_outhdr {
+	u32 type;
+	u32 ioprio;
+	u64 sector;
+};
+
+struct virtio_blk_req {
+	struct virtio_blk_outhdr hdr;
+	u8 status;
+	/* Not seen by the device, left to the caller. */
+	u64 start;
+	void *priv;
+};
+
+struct virtio_blk {
+	struct virtio_device *vdev;
+	/* in 512 byte sectors */
+	u64 capacity;
+	unsigned int blk_size;
+	unsigned int nr_queues;
+	struct virtqueue *vqs[VIRTIO_BLK_MAX_QUEUES];
+};
+
+/*
+ * virtio_blk_init binds the first virtio-blk device and sets up as many
+ * queues as it has, up to VIRTIO_BLK_MAX_QUEUES.  @features are the
+ * transport or ring features to ask for besides VIRTIO_BLK_F_MQ, such
+ * as VIRTIO_RING_F_EVENT_IDX or VIRTIO_F_RING_PACKED.  Returns false if
+ * there is no device.
+ */
+extern bool virtio_blk_init(struct virtio_blk *blk, u64 features);
+
+/* virtio_blk_alloc_reqs returns @nr zeroed requests the device can access. */
+extern struct virtio_blk_req *virtio_blk_alloc_reqs(unsigned int nr);
+
+/*
+ * virtio_blk_queue adds a @type request for @len bytes at @sector to
+ * queue @q, without notifying the device.  Returns -1 if the queue is
+ * full.
+ */
+extern int virtio_blk_queue(struct virtio_blk *blk, unsigned int q,
+			    struct virtio_blk_req *req, u32 type, u64 sector,
+			    void *buf, unsigned int len);
+extern void virtio_blk_kick(struct virtio_blk *blk, unsigned int q);
+
+/* Returns the next completed request of queue @q, or NULL. */
+extern struct virtio_blk_req *virtio_blk_get_req(struct virtio_blk *blk,
+						 unsigned int q);
+
+#endif /* _VIRTIO_BLK_H_ */
@@ -36,6 +36,30 @@ static void vm_set(struct virtio_device *vdev, unsigned offset,
 		writeb(p[i], vm_dev->base + VIRTIO_MMIO_CONFIG + offset + i);
 }
 
+static u64 vm_get_features(struct virtio_device *vdev)
+{
+	struct virtio_mmio_device *vm_dev = to_virtio_mmio_device(vdev);
+	u64 features;
+
+	writel(1, vm_dev->base + VIRTIO_MMIO_HOST_FEATURES_SEL);
+	features = readl(vm_dev->base + VIRTIO_MMIO_HOST_FEATURES);
+	features <<= 32;
+	writel(0, vm_dev->base + VIRTIO_MMIO_HOST_FEATURES_SEL);
+	features |= readl(vm_dev->base + VIRTIO_MMIO_HOST_FEATURES);
+
+	return features;
+}
+
+static void vm_finalize_features(struct virtio_device *vdev)
+{
+	struct virtio_mmio_device *vm_dev = to_virtio_mmio_device(vdev);
+
+	writel(1, vm_dev->base + VIRTIO_MMIO_GUEST_FEATURES_SEL);
+	writel((u32)(vdev->features >> 32), vm_dev->base + VIRTIO_MMIO_GUEST_FEATURES);
+	writel(0, vm_dev->base + VIRTIO_MMIO_GUEST_FEATURES_SEL);
+	writel((u32)vdev->features, vm_dev->base + VIRTIO_MMIO_GUEST_FEATURES);
+}
+
 static bool vm_notify(struct virtqueue *vq)
 {
 	struct virtio_mmio_device *vm_dev = to_virtio_mmio_device(vq->vdev);
@@ -53,8 +77,10 @@ static struct virtqueue *vm_setup_vq(struct virtio_device *vdev,
 	void *queue;
 	unsigned num = VIRTIO_MMIO_QUEUE_NUM_MIN;
 
-	vq = calloc(1, sizeof(*vq));
+	vq = vring_alloc_virtqueue(num);
 	assert(VIRTIO_MMIO_QUEUE_SIZE_MIN <= 2*PAGE_SIZE);
+	assert(vring_size(vdev, num, VIRTIO_MMIO_VRING_ALIGN) <=
+	       VIRTIO_MMIO_QUEUE_SIZE_MIN);
 	queue = alloc_pages(1);
 	assert(vq && queue);
 
@@ -100,6 +126,8 @@ static const struct virtio_config_ops vm_config_ops = {
 	.get = vm_get,
 	.set = vm_set,
 	.find_vqs = vm_find_vqs,
+	.get_features = vm_get_features,
+	.finalize_features = vm_finalize_features,
 };
 
 static void vm_device_init(struct virtio_mmio_device *vm_dev)
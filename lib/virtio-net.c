@@ -0,0 +1,70 @@
+/*
+ * A minimal polled virtio-net driver, see virtio-net.h
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+#include "libcflat.h"
+#include "virtio.h"
+#include "virtio-net.h"
+
+bool virtio_net_init(struct virtio_net *net, u64 features)
+{
+	struct virtqueue *vqs[2];
+	struct virtio_device *vdev;
+	int i, ret;
+
+	memset(net, 0, sizeof(*net));
+
+	vdev = virtio_bind(VIRTIO_ID_NET);
+	if (!vdev)
+		return false;
+
+	virtio_negotiate_features(vdev, features | (1ull << VIRTIO_NET_F_MAC));
+
+	net->vdev = vdev;
+	if (virtio_has_feature(vdev, VIRTIO_NET_F_MAC))
+		for (i = 0; i < ETH_ALEN; i++)
+			net->mac[i] = virtio_config_readb(vdev,
+						VIRTIO_NET_CFG_MAC + i);
+
+	/* Legacy devices leave out num_buffers unless they merge buffers. */
+	net->hdr_len = sizeof(struct virtio_net_hdr);
+	if (!virtio_has_feature(vdev, VIRTIO_F_VERSION_1) &&
+	    !virtio_has_feature(vdev, VIRTIO_NET_F_MRG_RXBUF))
+		net->hdr_len -= sizeof(u16);
+
+	ret = vdev->config->find_vqs(vdev, 2, vqs, NULL, NULL);
+	assert(ret == 0);
+	net->rx = vqs[VIRTIO_NET_RX_QUEUE];
+	net->tx = vqs[VIRTIO_NET_TX_QUEUE];
+
+	return true;
+}
+
+int virtio_net_add_rx(struct virtio_net *net, void *buf, unsigned int len)
+{
+	assert(len > net->hdr_len);
+	return virtqueue_add_inbuf(net->rx, buf, len);
+}
+
+int virtio_net_add_tx(struct virtio_net *net, void *buf, unsigned int len)
+{
+	assert(len > net->hdr_len);
+	return virtqueue_add_outbuf(net->tx, buf, len);
+}
+
+void *virtio_net_get_rx(struct virtio_net *net, unsigned int *len)
+{
+	void *buf = virtqueue_get_buf(net->rx, len);
+
+	if (buf)
+		*len -= net->hdr_len;
+	return buf;
+}
+
+void *virtio_net_get_tx(struct virtio_net *net)
+{
+	unsigned int len;
+
+	return virtqueue_get_buf(net->tx, &len);
+}
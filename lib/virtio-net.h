@@ -0,0 +1,76 @@
+#ifndef _VIRTIO_NET_H_
+#define _VIRTIO_NET_H_
+/*
+ * A minimal polled virtio-net driver, using the first receive and
+ * transmit queue pair only.
+ *
+ * As with virtio-blk, each queue is meant to be used by a single CPU and
+ * buffers must be physically contiguous and have virt_to_phys() work on
+ * them.  Every buffer starts with hdr_len bytes of struct
+ * virtio_net_hdr, followed by the Ethernet frame.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+#include "libcflat.h"
+#include "virtio.h"
+
+#define VIRTIO_NET_F_MAC	5
+#define VIRTIO_NET_F_MRG_RXBUF	15
+
+/* struct virtio_net_config */
+#define VIRTIO_NET_CFG_MAC	0
+
+#define VIRTIO_NET_RX_QUEUE	0
+#define VIRTIO_NET_TX_QUEUE	1
+
+#define ETH_ALEN		6
+#define ETH_HLEN		14
+#define ETH_ZLEN		60
+#define ETH_FRAME_LEN		1514
+
+struct virtio_net_hdr {
+	u8 flags;
+	u8 gso_type;
+	u16 hdr_len;
+	u16 gso_size;
+	u16 csum_start;
+	u16 csum_offset;
+	/* only with VIRTIO_F_VERSION_1 or VIRTIO_NET_F_MRG_RXBUF */
+	u16 num_buffers;
+};
+
+struct virtio_net {
+	struct virtio_device *vdev;
+	u8 mac[ETH_ALEN];
+	unsigned int hdr_len;
+	struct virtqueue *rx;
+	struct virtqueue *tx;
+};
+
+/*
+ * virtio_net_init binds the next virtio-net device, see virtio_bind.
+ * @features are the transport or ring features to ask for.  Returns
+ * false if there is no device left.
+ */
+extern bool virtio_net_init(struct virtio_net *net, u64 features);
+
+/*
+ * virtio_net_add_rx and virtio_net_add_tx queue one buffer of @len bytes,
+ * header included, without notifying the device.  They return -1 if the
+ * queue is full.
+ */
+extern int virtio_net_add_rx(struct virtio_net *net, void *buf,
+			     unsigned int len);
+extern int virtio_net_add_tx(struct virtio_net *net, void *buf,
+			     unsigned int len);
+
+/*
+ * virtio_net_get_rx returns the next received buffer and sets @len to
+ * the length of the frame, without the header.  virtio_net_get_tx
+ * returns the next buffer the device is done sending.  Both return NULL
+ * if there is none.
+ */
+extern void *virtio_net_get_rx(struct virtio_net *net, unsigned int *len);
+extern void *virtio_net_get_tx(struct virtio_net *net);
+
+#endif /* _VIRTIO_NET_H_ */
@@ -0,0 +1,315 @@
+/*
+ * Modern virtio-pci transport, adapted from the Linux kernel.
+ *
+ * Unlike legacy virtio-mmio, the device tells where its registers are
+ * through vendor specific capabilities, takes the three ring areas at
+ * separate addresses, and needs VIRTIO_F_VERSION_1 and FEATURES_OK
+ * before its queues are set up.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+#include "libcflat.h"
+#include "alloc_page.h"
+#include "alloc.h"
+#include "asm/page.h"
+#include "asm/io.h"
+#include <linux/pci_regs.h>
+#include "virtio.h"
+#include "virtio-pci.h"
+#include "asm/pci.h"
+
+static void vp_get(struct virtio_device *vdev, unsigned offset,
+		   void *buf, unsigned len)
+{
+	struct virtio_pci_device *vp_dev = to_virtio_pci_device(vdev);
+	u8 *p = buf;
+	unsigned i;
+
+	assert(vp_dev->device);
+	for (i = 0; i < len; ++i)
+		p[i] = readb(vp_dev->device + offset + i);
+}
+
+static void vp_set(struct virtio_device *vdev, unsigned offset,
+		   const void *buf, unsigned len)
+{
+	struct virtio_pci_device *vp_dev = to_virtio_pci_device(vdev);
+	const u8 *p = buf;
+	unsigned i;
+
+	assert(vp_dev->device);
+	for (i = 0; i < len; ++i)
+		writeb(p[i], vp_dev->device + offset + i);
+}
+
+static u8 vp_get_status(struct virtio_pci_device *vp_dev)
+{
+	return readb(vp_dev->common + VIRTIO_PCI_COMMON_STATUS);
+}
+
+static void vp_add_status(struct virtio_pci_device *vp_dev, u8 status)
+{
+	writeb(vp_get_status(vp_dev) | status,
+	       vp_dev->common + VIRTIO_PCI_COMMON_STATUS);
+}
+
+static void vp_reset(struct virtio_pci_device *vp_dev)
+{
+	writeb(0, vp_dev->common + VIRTIO_PCI_COMMON_STATUS);
+	/* The reset is complete once the device reads back 0. */
+	while (vp_get_status(vp_dev))
+		cpu_relax();
+}
+
+static void vp_write64(u64 val, void *lo, void *hi)
+{
+	writel((u32)val, lo);
+	writel((u32)(val >> 32), hi);
+}
+
+static u64 vp_get_features(struct virtio_device *vdev)
+{
+	struct virtio_pci_device *vp_dev = to_virtio_pci_device(vdev);
+	u64 features;
+
+	writel(1, vp_dev->common + VIRTIO_PCI_COMMON_DFSELECT);
+	features = readl(vp_dev->common + VIRTIO_PCI_COMMON_DF);
+	features <<= 32;
+	writel(0, vp_dev->common + VIRTIO_PCI_COMMON_DFSELECT);
+	features |= readl(vp_dev->common + VIRTIO_PCI_COMMON_DF);
+
+	return features;
+}
+
+static void vp_finalize_features(struct virtio_device *vdev)
+{
+	struct virtio_pci_device *vp_dev = to_virtio_pci_device(vdev);
+
+	/* Modern devices offer VIRTIO_F_VERSION_1 and need it back. */
+	assert(vp_get_features(vdev) & (1ull << VIRTIO_F_VERSION_1));
+	vdev->features |= 1ull << VIRTIO_F_VERSION_1;
+
+	writel(1, vp_dev->common + VIRTIO_PCI_COMMON_GFSELECT);
+	writel((u32)(vdev->features >> 32),
+	       vp_dev->common + VIRTIO_PCI_COMMON_GF);
+	writel(0, vp_dev->common + VIRTIO_PCI_COMMON_GFSELECT);
+	writel((u32)vdev->features, vp_dev->common + VIRTIO_PCI_COMMON_GF);
+
+	vp_add_status(vp_dev, VIRTIO_CONFIG_S_FEATURES_OK);
+	assert(vp_get_status(vp_dev) & VIRTIO_CONFIG_S_FEATURES_OK);
+}
+
+static bool vp_notify(struct virtqueue *vq)
+{
+	writew(vq->index, vq->priv);
+	return true;
+}
+
+static struct virtqueue *vp_setup_vq(struct virtio_device *vdev,
+				     unsigned index,
+				     void (*callback)(struct virtqueue *vq),
+				     const char *name)
+{
+	struct virtio_pci_device *vp_dev = to_virtio_pci_device(vdev);
+	void *common = vp_dev->common;
+	struct vring_virtqueue *vq;
+	void *desc, *driver, *device;
+	unsigned long size;
+	unsigned num;
+	void *queue;
+
+	writew(index, common + VIRTIO_PCI_COMMON_Q_SELECT);
+
+	num = readw(common + VIRTIO_PCI_COMMON_Q_SIZE);
+	if (num == 0) {
+		printf("%s: virtqueue %d does not exist\n", __func__, index);
+		return NULL;
+	}
+
+	if (readw(common + VIRTIO_PCI_COMMON_Q_ENABLE)) {
+		printf("%s: virtqueue %d already setup!\n", __func__, index);
+		return NULL;
+	}
+
+	num = MIN(num, VIRTIO_PCI_QUEUE_NUM_MAX);
+	size = vring_size(vdev, num, VIRTIO_PCI_VRING_ALIGN);
+	vq = vring_alloc_virtqueue(num);
+	queue = alloc_pages(get_order(ALIGN(size, PAGE_SIZE) >> PAGE_SHIFT));
+	assert(vq && queue);
+
+	vring_init_virtqueue(vq, index, num, VIRTIO_PCI_VRING_ALIGN,
+			     vdev, queue, vp_notify, callback, name);
+
+	if (vq->is_packed) {
+		desc = vq->packed.desc;
+		driver = vq->packed.driver;
+		device = vq->packed.device;
+	} else {
+		desc = vq->vring.desc;
+		driver = vq->vring.avail;
+		device = vq->vring.used;
+	}
+
+	writew(num, common + VIRTIO_PCI_COMMON_Q_SIZE);
+	vp_write64(virt_to_phys(desc), common + VIRTIO_PCI_COMMON_Q_DESCLO,
+		   common + VIRTIO_PCI_COMMON_Q_DESCHI);
+	vp_write64(virt_to_phys(driver), common + VIRTIO_PCI_COMMON_Q_AVAILLO,
+		   common + VIRTIO_PCI_COMMON_Q_AVAILHI);
+	vp_write64(virt_to_phys(device), common + VIRTIO_PCI_COMMON_Q_USEDLO,
+		   common + VIRTIO_PCI_COMMON_Q_USEDHI);
+
+	vq->vq.priv = vp_dev->notify_base +
+		readw(common + VIRTIO_PCI_COMMON_Q_NOFF) *
+		vp_dev->notify_off_multiplier;
+
+	writew(1, common + VIRTIO_PCI_COMMON_Q_ENABLE);
+
+	return &vq->vq;
+}
+
+static int vp_find_vqs(struct virtio_device *vdev, unsigned nvqs,
+		       struct virtqueue *vqs[], vq_callback_t *callbacks[],
+		       const char *names[])
+{
+	struct virtio_pci_device *vp_dev = to_virtio_pci_device(vdev);
+	unsigned i;
+
+	if (!(vp_get_status(vp_dev) & VIRTIO_CONFIG_S_FEATURES_OK))
+		virtio_negotiate_features(vdev, 0);
+
+	for (i = 0; i < nvqs; ++i) {
+		vqs[i] = vp_setup_vq(vdev, i,
+				     callbacks ? callbacks[i] : NULL,
+				     names ? names[i] : "");
+		if (vqs[i] == NULL)
+			return -1;
+	}
+
+	vp_add_status(vp_dev, VIRTIO_CONFIG_S_DRIVER_OK);
+
+	return 0;
+}
+
+static const struct virtio_config_ops vp_config_ops = {
+	.get = vp_get,
+	.set = vp_set,
+	.find_vqs = vp_find_vqs,
+	.get_features = vp_get_features,
+	.finalize_features = vp_finalize_features,
+};
+
+/******************************************************
+ * virtio-pci capability parsing
+ ******************************************************/
+
+static void *vp_map_cap(struct pci_dev *dev, int cap_offset)
+{
+	u8 bar = pci_config_readb(dev->bdf, cap_offset + VIRTIO_PCI_CAP_BAR);
+	u32 offset = pci_config_readl(dev->bdf,
+				      cap_offset + VIRTIO_PCI_CAP_OFFSET);
+	u32 length = pci_config_readl(dev->bdf,
+				      cap_offset + VIRTIO_PCI_CAP_LENGTH);
+
+	if (bar >= PCI_BAR_NUM || dev->resource[bar] == INVALID_PHYS_ADDR ||
+	    !pci_bar_is_memory(dev, bar) || !length)
+		return NULL;
+
+	return ioremap(dev->resource[bar] + offset, length);
+}
+
+static void vp_cap_setup(struct pci_dev *dev, int cap_offset, int cap_id)
+{
+	struct virtio_pci_device *vp_dev =
+		container_of(dev, struct virtio_pci_device, pci_dev);
+	u8 type;
+
+	if (cap_id != PCI_CAP_ID_VNDR)
+		return;
+
+	/* The spec wants the first capability of each type to be used. */
+	type = pci_config_readb(dev->bdf, cap_offset + VIRTIO_PCI_CAP_CFG_TYPE);
+	switch (type) {
+	case VIRTIO_PCI_CAP_COMMON_CFG:
+		if (!vp_dev->common)
+			vp_dev->common = vp_map_cap(dev, cap_offset);
+		break;
+	case VIRTIO_PCI_CAP_NOTIFY_CFG:
+		if (vp_dev->notify_base)
+			break;
+		vp_dev->notify_base = vp_map_cap(dev, cap_offset);
+		vp_dev->notify_off_multiplier = pci_config_readl(dev->bdf,
+				cap_offset + VIRTIO_PCI_NOTIFY_CAP_MULT);
+		break;
+	case VIRTIO_PCI_CAP_ISR_CFG:
+		if (!vp_dev->isr)
+			vp_dev->isr = vp_map_cap(dev, cap_offset);
+		break;
+	case VIRTIO_PCI_CAP_DEVICE_CFG:
+		if (!vp_dev->device)
+			vp_dev->device = vp_map_cap(dev, cap_offset);
+		break;
+	}
+}
+
+static bool vp_match(pcidevaddr_t bdf, u32 devid)
+{
+	u16 device;
+
+	if (pci_config_readw(bdf, PCI_VENDOR_ID) != PCI_VENDOR_ID_REDHAT_QUMRANET)
+		return false;
+
+	device = pci_config_readw(bdf, PCI_DEVICE_ID);
+	if (device >= VIRTIO_PCI_DEVICE_ID_MODERN &&
+	    device <= VIRTIO_PCI_DEVICE_ID_MAX)
+		return device - VIRTIO_PCI_DEVICE_ID_MODERN == devid;
+	if (device >= VIRTIO_PCI_DEVICE_ID_TRANS_MIN &&
+	    device <= VIRTIO_PCI_DEVICE_ID_TRANS_MAX)
+		return pci_config_readw(bdf, PCI_SUBSYSTEM_ID) == devid;
+
+	return false;
+}
+
+static bool vp_bound[PCI_DEVFN_MAX];
+
+struct virtio_device *virtio_pci_bind(u32 devid)
+{
+	struct virtio_pci_device *vp_dev;
+	pcidevaddr_t bdf;
+
+	if (!pci_available())
+		return NULL;
+
+	for (bdf = 0; bdf < PCI_DEVFN_MAX; ++bdf) {
+		if (vp_bound[bdf] || !vp_match(bdf, devid))
+			continue;
+
+		vp_dev = calloc(1, sizeof(*vp_dev));
+		assert(vp_dev != NULL);
+
+		pci_dev_init(&vp_dev->pci_dev, bdf);
+		pci_cap_walk(&vp_dev->pci_dev, vp_cap_setup);
+
+		/* Legacy only devices have no capabilities, skip them. */
+		if (!vp_dev->common || !vp_dev->notify_base) {
+			free(vp_dev);
+			continue;
+		}
+
+		pci_cmd_set_clr(&vp_dev->pci_dev,
+				PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER, 0);
+
+		vp_dev->vdev.id.device = devid;
+		vp_dev->vdev.id.vendor = pci_config_readw(bdf,
+						PCI_SUBSYSTEM_VENDOR_ID);
+		vp_dev->vdev.config = &vp_config_ops;
+
+		vp_reset(vp_dev);
+		vp_add_status(vp_dev, VIRTIO_CONFIG_S_ACKNOWLEDGE);
+		vp_add_status(vp_dev, VIRTIO_CONFIG_S_DRIVER);
+
+		vp_bound[bdf] = true;
+		return &vp_dev->vdev;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,83 @@
+#ifndef _VIRTIO_PCI_H_
+#define _VIRTIO_PCI_H_
+/*
+ * A minimal implementation of the modern (virtio 1.0) virtio-pci
+ * transport.  Adapted from the Linux Kernel.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+#include "libcflat.h"
+#include "pci.h"
+#include "virtio.h"
+
+#define PCI_VENDOR_ID_REDHAT_QUMRANET	0x1af4
+
+/* Transitional devices carry the virtio device id in the subsystem id. */
+#define VIRTIO_PCI_DEVICE_ID_TRANS_MIN	0x1000
+#define VIRTIO_PCI_DEVICE_ID_TRANS_MAX	0x103f
+#define VIRTIO_PCI_DEVICE_ID_MODERN	0x1040
+#define VIRTIO_PCI_DEVICE_ID_MAX	0x107f
+
+/* struct virtio_pci_cap, a vendor specific PCI capability */
+#define VIRTIO_PCI_CAP_CFG_TYPE		3
+#define VIRTIO_PCI_CAP_BAR		4
+#define VIRTIO_PCI_CAP_OFFSET		8
+#define VIRTIO_PCI_CAP_LENGTH		12
+#define VIRTIO_PCI_NOTIFY_CAP_MULT	16
+
+#define VIRTIO_PCI_CAP_COMMON_CFG	1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG	2
+#define VIRTIO_PCI_CAP_ISR_CFG		3
+#define VIRTIO_PCI_CAP_DEVICE_CFG	4
+
+/* struct virtio_pci_common_cfg */
+#define VIRTIO_PCI_COMMON_DFSELECT	0x00
+#define VIRTIO_PCI_COMMON_DF		0x04
+#define VIRTIO_PCI_COMMON_GFSELECT	0x08
+#define VIRTIO_PCI_COMMON_GF		0x0c
+#define VIRTIO_PCI_COMMON_MSIX		0x10
+#define VIRTIO_PCI_COMMON_NUMQ		0x12
+#define VIRTIO_PCI_COMMON_STATUS	0x14
+#define VIRTIO_PCI_COMMON_CFGGENERATION	0x15
+#define VIRTIO_PCI_COMMON_Q_SELECT	0x16
+#define VIRTIO_PCI_COMMON_Q_SIZE	0x18
+#define VIRTIO_PCI_COMMON_Q_MSIX	0x1a
+#define VIRTIO_PCI_COMMON_Q_ENABLE	0x1c
+#define VIRTIO_PCI_COMMON_Q_NOFF	0x1e
+#define VIRTIO_PCI_COMMON_Q_DESCLO	0x20
+#define VIRTIO_PCI_COMMON_Q_DESCHI	0x24
+#define VIRTIO_PCI_COMMON_Q_AVAILLO	0x28
+#define VIRTIO_PCI_COMMON_Q_AVAILHI	0x2c
+#define VIRTIO_PCI_COMMON_Q_USEDLO	0x30
+#define VIRTIO_PCI_COMMON_Q_USEDHI	0x34
+
+/*
+ * Queues are sized to what the device offers, up to this many entries.
+ * Modern devices only need the used ring 4-byte aligned, a cache line
+ * keeps it apart from the avail ring.
+ */
+#define VIRTIO_PCI_QUEUE_NUM_MAX	256
+#define VIRTIO_PCI_VRING_ALIGN		64
+
+#define to_virtio_pci_device(vdev_ptr) \
+	container_of(vdev_ptr, struct virtio_pci_device, vdev)
+
+struct virtio_pci_device {
+	struct virtio_device vdev;
+	struct pci_dev pci_dev;
+	void *common;
+	void *notify_base;
+	u32 notify_off_multiplier;
+	void *isr;
+	void *device;
+};
+
+/*
+ * virtio_pci_bind returns the first modern or transitional virtio-pci
+ * device of type @devid on bus 0 that is not bound yet, reset and
+ * acknowledged, so calling it again returns the next one.  On
+ * architectures with a host bridge driver, PCI must have been probed.
+ */
+extern struct virtio_device *virtio_pci_bind(u32 devid);
+
+#endif /* _VIRTIO_PCI_H_ */
@@ -7,8 +7,10 @@
  */
 #include "libcflat.h"
 #include "asm/io.h"
+#include "alloc.h"
 #include "virtio.h"
 #include "virtio-mmio.h"
+#include "virtio-pci.h"
 
 void vring_init(struct vring *vr, unsigned int num, void *p,
 		       unsigned long align)
@@ -20,6 +22,32 @@ void vring_init(struct vring *vr, unsigned int num, void *p,
 		+ align-1) & ~(align - 1));
 }
 
+void vring_packed_init(struct vring_packed *vr, unsigned int num, void *p)
+{
+	vr->num = num;
+	vr->desc = p;
+	vr->driver = p + num*sizeof(struct vring_packed_desc);
+	vr->device = (void *)(vr->driver + 1);
+}
+
+unsigned long vring_size(struct virtio_device *vdev, unsigned int num,
+			 unsigned long align)
+{
+	if (virtio_has_feature(vdev, VIRTIO_F_RING_PACKED))
+		return num*sizeof(struct vring_packed_desc)
+			+ 2*sizeof(struct vring_packed_desc_event);
+
+	return ((num*sizeof(struct vring_desc) + sizeof(u16)*(3 + num)
+		 + align-1) & ~(align - 1))
+		+ sizeof(u16)*3 + sizeof(struct vring_used_elem)*num;
+}
+
+struct vring_virtqueue *vring_alloc_virtqueue(unsigned int num)
+{
+	return calloc(1, sizeof(struct vring_virtqueue)
+			 + num*sizeof(struct vring_desc_state));
+}
+
 void vring_init_virtqueue(struct vring_virtqueue *vq, unsigned index,
 			  unsigned num, unsigned vring_align,
 			  struct virtio_device *vdev, void *pages,
@@ -29,7 +57,6 @@ void vring_init_virtqueue(struct vring_virtqueue *vq, unsigned index,
 {
 	unsigned i;
 
-	vring_init(&vq->vring, num, pages, vring_align);
 	vq->vq.callback = callback;
 	vq->vq.vdev = vdev;
 	vq->vq.name = name;
@@ -37,61 +64,203 @@ void vring_init_virtqueue(struct vring_virtqueue *vq, unsigned index,
 	vq->vq.index = index;
 	vq->notify = notify;
 	vq->last_used_idx = 0;
+	vq->next_avail_idx = 0;
+	vq->avail_wrap = true;
+	vq->used_wrap = true;
 	vq->num_added = 0;
 	vq->free_head = 0;
+	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
+	vq->is_packed = virtio_has_feature(vdev, VIRTIO_F_RING_PACKED);
+
+	if (vq->is_packed) {
+		vring_packed_init(&vq->packed, num, pages);
+		/* Without a callback the queue is polled. */
+		if (!callback)
+			vq->packed.driver->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+	} else {
+		vring_init(&vq->vring, num, pages, vring_align);
+		if (!callback)
+			vq->vring.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+		for (i = 0; i < num-1; i++)
+			vq->vring.desc[i].next = i+1;
+	}
 
-	for (i = 0; i < num-1; i++) {
-		vq->vring.desc[i].next = i+1;
-		vq->data[i] = NULL;
+	for (i = 0; i < num; i++) {
+		vq->desc_state[i].data = NULL;
+		vq->desc_state[i].next = i+1;
 	}
-	vq->data[i] = NULL;
 }
 
-int virtqueue_add_outbuf(struct virtqueue *_vq, char *buf, unsigned int len)
+static int virtqueue_add_split(struct vring_virtqueue *vq,
+			       struct virtio_buf *bufs, unsigned int out,
+			       unsigned int in, void *data)
 {
-	struct vring_virtqueue *vq = to_vvq(_vq);
+	unsigned int total = out + in, n;
+	struct vring_desc *desc;
 	unsigned avail;
-	int head;
+	int head, i;
 
-	assert(buf != NULL);
-	assert(len != 0);
+	head = i = vq->free_head;
+	for (n = 0; n < total; n++) {
+		desc = &vq->vring.desc[i];
+		desc->addr = virt_to_phys(bufs[n].addr);
+		desc->len = bufs[n].len;
+		desc->flags = (n >= out ? VRING_DESC_F_WRITE : 0) |
+			      (n + 1 < total ? VRING_DESC_F_NEXT : 0);
+		i = desc->next;
+	}
 
-	if (!vq->vq.num_free)
-		return -1;
+	vq->free_head = i;
+	vq->vq.num_free -= total;
+	vq->desc_state[head].data = data;
 
-	--vq->vq.num_free;
+	avail = (vq->vring.avail->idx & (vq->vring.num-1));
+	vq->vring.avail->ring[avail] = head;
+	wmb();
+	vq->vring.avail->idx++;
+	vq->num_added++;
 
-	head = vq->free_head;
+	return 0;
+}
 
-	vq->vring.desc[head].flags = 0;
-	vq->vring.desc[head].addr = virt_to_phys(buf);
-	vq->vring.desc[head].len = len;
+static int virtqueue_add_packed(struct vring_virtqueue *vq,
+				struct virtio_buf *bufs, unsigned int out,
+				unsigned int in, void *data)
+{
+	unsigned int total = out + in, n;
+	struct vring_packed_desc *desc;
+	struct vring_desc_state *state;
+	u16 id, head, i, flags, head_flags = 0;
+	bool wrap = vq->avail_wrap;
 
-	vq->free_head = vq->vring.desc[head].next;
+	id = vq->free_head;
+	head = i = vq->next_avail_idx;
+	for (n = 0; n < total; n++) {
+		desc = &vq->packed.desc[i];
+		desc->addr = virt_to_phys(bufs[n].addr);
+		desc->len = bufs[n].len;
+		desc->id = id;
+		flags = (n >= out ? VRING_DESC_F_WRITE : 0) |
+			(n + 1 < total ? VRING_DESC_F_NEXT : 0) |
+			(wrap ? VRING_PACKED_DESC_F_AVAIL
+			      : VRING_PACKED_DESC_F_USED);
+		/* The head goes last, it makes the whole chain available. */
+		if (n == 0)
+			head_flags = flags;
+		else
+			desc->flags = flags;
+		if (++i == vq->packed.num) {
+			i = 0;
+			wrap = !wrap;
+		}
+	}
 
-	vq->data[head] = buf;
+	state = &vq->desc_state[id];
+	vq->free_head = state->next;
+	state->data = data;
+	state->num = total;
+	vq->vq.num_free -= total;
+	vq->next_avail_idx = i;
+	vq->avail_wrap = wrap;
+	vq->num_added += total;
 
-	avail = (vq->vring.avail->idx & (vq->vring.num-1));
-	vq->vring.avail->ring[avail] = head;
 	wmb();
-	vq->vring.avail->idx++;
-	vq->num_added++;
+	vq->packed.desc[head].flags = head_flags;
 
 	return 0;
 }
 
+int virtqueue_add(struct virtqueue *_vq, struct virtio_buf *bufs,
+		  unsigned int out, unsigned int in, void *data)
+{
+	struct vring_virtqueue *vq = to_vvq(_vq);
+	unsigned int n;
+
+	assert(out + in != 0);
+	assert(data != NULL);
+
+	if (vq->vq.num_free < out + in)
+		return -1;
+
+	for (n = 0; n < out + in; n++)
+		assert(bufs[n].len != 0);
+
+	if (vq->is_packed)
+		return virtqueue_add_packed(vq, bufs, out, in, data);
+	return virtqueue_add_split(vq, bufs, out, in, data);
+}
+
+int virtqueue_add_outbuf(struct virtqueue *_vq, char *buf, unsigned int len)
+{
+	struct virtio_buf vb = { buf, len };
+
+	assert(buf != NULL);
+	return virtqueue_add(_vq, &vb, 1, 0, buf);
+}
+
+int virtqueue_add_inbuf(struct virtqueue *_vq, char *buf, unsigned int len)
+{
+	struct virtio_buf vb = { buf, len };
+
+	assert(buf != NULL);
+	return virtqueue_add(_vq, &vb, 0, 1, buf);
+}
+
+static bool virtqueue_kick_packed(struct vring_virtqueue *vq)
+{
+	u16 new = vq->next_avail_idx;
+	u16 old = new - vq->num_added;
+	u16 off_wrap, flags, event_idx;
+	u32 event;
+
+	/* The device may update both fields, read them at once. */
+	event = *(volatile u32 *)vq->packed.device;
+	off_wrap = event;
+	flags = event >> 16;
+
+	if (flags != VRING_PACKED_EVENT_FLAG_DESC)
+		return flags != VRING_PACKED_EVENT_FLAG_DISABLE;
+
+	event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+	if ((off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) != vq->avail_wrap)
+		event_idx -= vq->packed.num;
+
+	return vring_need_event(event_idx, new, old);
+}
+
+static bool virtqueue_kick_split(struct vring_virtqueue *vq)
+{
+	u16 new = vq->vring.avail->idx;
+	u16 old = new - vq->num_added;
+
+	if (vq->event)
+		return vring_need_event(vring_avail_event(&vq->vring),
+					new, old);
+
+	return !(vq->vring.used->flags & VRING_USED_F_NO_NOTIFY);
+}
+
 bool virtqueue_kick(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
+	bool needed;
+
 	mb();
-	return vq->notify(_vq);
+
+	if (vq->is_packed)
+		needed = virtqueue_kick_packed(vq);
+	else
+		needed = virtqueue_kick_split(vq);
+
+	vq->num_added = 0;
+	return needed ? vq->notify(_vq) : true;
 }
 
 void detach_buf(struct vring_virtqueue *vq, unsigned head)
 {
 	unsigned i = head;
 
-	vq->data[head] = NULL;
+	vq->desc_state[head].data = NULL;
 
 	while (vq->vring.desc[i].flags & VRING_DESC_F_NEXT) {
 		i = vq->vring.desc[i].next;
@@ -103,6 +272,44 @@ void detach_buf(struct vring_virtqueue *vq, unsigned head)
 	vq->vq.num_free++;
 }
 
+static void *virtqueue_get_buf_packed(struct vring_virtqueue *vq,
+				      unsigned int *len)
+{
+	struct vring_packed_desc *desc = &vq->packed.desc[vq->last_used_idx];
+	u16 flags = *(volatile u16 *)&desc->flags;
+	struct vring_desc_state *state;
+	bool avail, used;
+	void *ret;
+	u16 id;
+
+	avail = flags & VRING_PACKED_DESC_F_AVAIL;
+	used = flags & VRING_PACKED_DESC_F_USED;
+	if (avail != used || used != vq->used_wrap)
+		return NULL;
+	rmb();
+
+	id = desc->id;
+	*len = desc->len;
+	assert(id < vq->packed.num && vq->desc_state[id].data);
+
+	state = &vq->desc_state[id];
+	ret = state->data;
+	state->data = NULL;
+	vq->vq.num_free += state->num;
+
+	/* The device writes a single used element for a whole chain. */
+	vq->last_used_idx += state->num;
+	if (vq->last_used_idx >= vq->packed.num) {
+		vq->last_used_idx -= vq->packed.num;
+		vq->used_wrap = !vq->used_wrap;
+	}
+
+	state->next = vq->free_head;
+	vq->free_head = id;
+
+	return ret;
+}
+
 void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
@@ -110,13 +317,18 @@ void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 	unsigned i;
 	void *ret;
 
+	if (vq->is_packed)
+		return virtqueue_get_buf_packed(vq, len);
+
+	if (vq->last_used_idx == *(volatile u16 *)&vq->vring.used->idx)
+		return NULL;
 	rmb();
 
 	last_used = (vq->last_used_idx & (vq->vring.num-1));
 	i = vq->vring.used->ring[last_used].id;
 	*len = vq->vring.used->ring[last_used].len;
 
-	ret = vq->data[i];
+	ret = vq->desc_state[i].data;
 	detach_buf(vq, i);
 
 	vq->last_used_idx++;
@@ -124,7 +336,21 @@ void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 	return ret;
 }
 
+void virtio_negotiate_features(struct virtio_device *vdev, u64 driver)
+{
+	vdev->features = vdev->config->get_features(vdev) & driver;
+	vdev->config->finalize_features(vdev);
+}
+
 struct virtio_device *virtio_bind(u32 devid)
 {
-	return virtio_mmio_bind(devid);
+	struct virtio_device *vdev = NULL;
+
+#ifdef CONFIG_VIRTIO_MMIO
+	vdev = virtio_mmio_bind(devid);
+#endif
+	if (!vdev)
+		vdev = virtio_pci_bind(devid);
+
+	return vdev;
 }
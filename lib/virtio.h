@@ -10,8 +10,20 @@
  */
 #include "libcflat.h"
 
+#define VIRTIO_ID_NET 1
+#define VIRTIO_ID_BLOCK 2
 #define VIRTIO_ID_CONSOLE 3
 
+#define VIRTIO_RING_F_EVENT_IDX	29
+#define VIRTIO_F_VERSION_1	32
+#define VIRTIO_F_RING_PACKED	34
+
+#define VIRTIO_CONFIG_S_ACKNOWLEDGE	1
+#define VIRTIO_CONFIG_S_DRIVER		2
+#define VIRTIO_CONFIG_S_DRIVER_OK	4
+#define VIRTIO_CONFIG_S_FEATURES_OK	8
+#define VIRTIO_CONFIG_S_FAILED		0x80
+
 struct virtio_device_id {
 	u32 device;
 	u32 vendor;
@@ -20,6 +32,7 @@ struct virtio_device_id {
 struct virtio_device {
 	struct virtio_device_id id;
 	const struct virtio_config_ops *config;
+	u64 features;
 };
 
 struct virtqueue {
@@ -41,8 +54,16 @@ struct virtio_config_ops {
 			struct virtqueue *vqs[],
 			vq_callback_t *callbacks[],
 			const char *names[]);
+	u64 (*get_features)(struct virtio_device *vdev);
+	void (*finalize_features)(struct virtio_device *vdev);
 };
 
+static inline bool
+virtio_has_feature(struct virtio_device *vdev, unsigned int bit)
+{
+	return vdev->features & (1ull << bit);
+}
+
 static inline u8
 virtio_config_readb(struct virtio_device *vdev, unsigned offset)
 {
@@ -88,6 +109,9 @@ virtio_config_writel(struct virtio_device *vdev, unsigned offset, u32 val)
 #define VRING_DESC_F_NEXT	1
 #define VRING_DESC_F_WRITE	2
 
+#define VRING_USED_F_NO_NOTIFY	1
+#define VRING_AVAIL_F_NO_INTERRUPT	1
+
 struct vring_desc {
 	u64 addr;
 	u32 len;
@@ -119,32 +143,151 @@ struct vring {
 	struct vring_used *used;
 };
 
+/*
+ * Packed virtqueues (VIRTIO_F_RING_PACKED) use a single ring.  The driver
+ * makes a descriptor available by setting its AVAIL flag to its wrap
+ * counter and its USED flag to the opposite, the device marks it used by
+ * setting both to its own wrap counter.  Both counters start at 1 and
+ * flip every time the index goes past the end of the ring.
+ */
+#define VRING_PACKED_DESC_F_AVAIL	(1 << 7)
+#define VRING_PACKED_DESC_F_USED	(1 << 15)
+
+#define VRING_PACKED_EVENT_FLAG_ENABLE	0
+#define VRING_PACKED_EVENT_FLAG_DISABLE	1
+#define VRING_PACKED_EVENT_FLAG_DESC	2
+#define VRING_PACKED_EVENT_F_WRAP_CTR	15
+
+struct vring_packed_desc {
+	u64 addr;
+	u32 len;
+	u16 id;
+	u16 flags;
+};
+
+struct vring_packed_desc_event {
+	u16 off_wrap;
+	u16 flags;
+};
+
+struct vring_packed {
+	unsigned int num;
+	struct vring_packed_desc *desc;
+	struct vring_packed_desc_event *driver;
+	struct vring_packed_desc_event *device;
+};
+
+/*
+ * With VIRTIO_RING_F_EVENT_IDX each side publishes, after the end of its
+ * own ring, the index at which it wants to be notified next.
+ */
+#define vring_used_event(vr)	((vr)->avail->ring[(vr)->num])
+#define vring_avail_event(vr)	(*(u16 *)&(vr)->used->ring[(vr)->num])
+
+static inline bool vring_need_event(u16 event_idx, u16 new_idx, u16 old)
+{
+	return (u16)(new_idx - event_idx - 1) < (u16)(new_idx - old);
+}
+
+/*
+ * Per request state, indexed by the head descriptor for split rings and
+ * by the buffer id for packed rings.  Packed rings keep the free ids in
+ * a list through @next, and need @num to skip a used chain.
+ */
+struct vring_desc_state {
+	void *data;
+	u16 num;
+	u16 next;
+};
+
 struct vring_virtqueue {
 	struct virtqueue vq;
 	struct vring vring;
+	struct vring_packed packed;
+	bool is_packed;
 	unsigned int free_head;
+	/* requests (split) or descriptors (packed) since the last kick */
 	unsigned int num_added;
 	u16 last_used_idx;
+	u16 next_avail_idx;
+	bool avail_wrap;
+	bool used_wrap;
+	bool event;
 	bool (*notify)(struct virtqueue *vq);
-	void *data[];
+	struct vring_desc_state desc_state[];
 };
 
 #define to_vvq(_vq) container_of(_vq, struct vring_virtqueue, vq)
 
+/* One element of a scatter-gather list for virtqueue_add. */
+struct virtio_buf {
+	void *addr;
+	unsigned int len;
+};
+
 extern void vring_init(struct vring *vr, unsigned int num, void *p,
 		       unsigned long align);
+extern void vring_packed_init(struct vring_packed *vr, unsigned int num,
+			      void *p);
+
+/*
+ * vring_size returns the number of bytes needed by the rings of a queue
+ * with @num entries, in the layout negotiated for @vdev.
+ */
+extern unsigned long vring_size(struct virtio_device *vdev, unsigned int num,
+				unsigned long align);
+extern struct vring_virtqueue *vring_alloc_virtqueue(unsigned int num);
+
+/*
+ * vring_init_virtqueue lays out the rings in @pages, as a packed ring if
+ * VIRTIO_F_RING_PACKED was negotiated and as a split ring otherwise.
+ */
 extern void vring_init_virtqueue(struct vring_virtqueue *vq, unsigned index,
 				 unsigned num, unsigned vring_align,
 				 struct virtio_device *vdev, void *pages,
 				 bool (*notify)(struct virtqueue *),
 				 void (*callback)(struct virtqueue *),
 				 const char *name);
+
+/*
+ * virtqueue_add queues one request made of @out device-readable buffers
+ * followed by @in device-writable ones, chained in a single descriptor
+ * list.  @data is returned by virtqueue_get_buf once the device is done.
+ * Returns -1 if there are not enough free descriptors.  The device is
+ * only told about new requests by virtqueue_kick, so several requests
+ * can be queued with a single notification.
+ */
+extern int virtqueue_add(struct virtqueue *vq, struct virtio_buf *bufs,
+			 unsigned int out, unsigned int in, void *data);
 extern int virtqueue_add_outbuf(struct virtqueue *vq, char *buf,
 				unsigned int len);
+extern int virtqueue_add_inbuf(struct virtqueue *vq, char *buf,
+			       unsigned int len);
+
+/*
+ * virtqueue_kick notifies the device of all requests added since the
+ * last kick, unless it asked not to be notified.
+ */
 extern bool virtqueue_kick(struct virtqueue *vq);
 extern void detach_buf(struct vring_virtqueue *vq, unsigned head);
+
+/* Returns NULL if the device has not completed another request yet. */
 extern void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len);
 
+/*
+ * virtio_negotiate_features sets @vdev->features to the @driver
+ * features the device also offers and passes them on to the device,
+ * before the virtqueues are set up.
+ */
+extern void virtio_negotiate_features(struct virtio_device *vdev,
+				      u64 driver);
+
+/*
+ * virtio_bind returns the first device of type @devid, looking first on
+ * the virtio-mmio transport, where the architecture has one, and then
+ * on PCI.  PCI devices are only returned once, further calls return
+ * the next one.
+ */
 extern struct virtio_device *virtio_bind(u32 devid);
 
 #endif /* _VIRTIO_H_ */
@@ -14,16 +14,140 @@
 #include "alloc_page.h"
 #include "vmalloc.h"
 
+#define NR_VFREE_STATIC	64
+
+/*
+ * Virtual address space is handed out downwards from vfree_top.  Freed
+ * ranges below it are kept sorted by address and coalesced, and are
+ * reused first fit.  The table of free ranges grows in pages taken from
+ * the page allocator; a range that doesn't fit when that fails is leaked.
+ */
+struct vrange {
+	void *start;
+	ulong nr;
+};
+
 static struct spinlock lock;
 static void *vfree_top = 0;
+static struct vrange vfree_static[NR_VFREE_STATIC];
+static struct vrange *vfree = vfree_static;
+static int nr_vfree, max_vfree = NR_VFREE_STATIC;
 static void *page_root;
+static bool vm_huge = true;
+
+static void vfree_remove(int i)
+{
+	nr_vfree--;
+	memmove(&vfree[i], &vfree[i + 1], (nr_vfree - i) * sizeof(vfree[0]));
+}
 
 void *alloc_vpages(ulong nr)
 {
+	void *p = NULL;
+	int i;
+
 	spin_lock(&lock);
-	vfree_top -= PAGE_SIZE * nr;
+	for (i = nr_vfree - 1; i >= 0; i--) {
+		if (vfree[i].nr < nr)
+			continue;
+		vfree[i].nr -= nr;
+		p = vfree[i].start + vfree[i].nr * PAGE_SIZE;
+		if (!vfree[i].nr)
+			vfree_remove(i);
+		break;
+	}
+	if (!p) {
+		vfree_top -= PAGE_SIZE * nr;
+		p = vfree_top;
+	}
 	spin_unlock(&lock);
-	return vfree_top;
+	return p;
+}
+
+/* Doubles the size of the free range table.  Called with the lock held. */
+static bool vfree_grow(void)
+{
+	size_t size = 2 * max_vfree * sizeof(struct vrange);
+	struct vrange *new;
+
+	if (!page_alloc_initialized())
+		return false;
+	new = alloc_pages_flags(get_order(DIV_ROUND_UP(size, PAGE_SIZE)),
+				ALLOC_NOZERO);
+	if (!new)
+		return false;
+
+	memcpy(new, vfree, nr_vfree * sizeof(struct vrange));
+	if (vfree != vfree_static)
+		free_pages(vfree, ALIGN(max_vfree * sizeof(struct vrange),
+					PAGE_SIZE));
+	vfree = new;
+	max_vfree *= 2;
+	return true;
+}
+
+/* Must be called with the lock held. */
+static void __free_vpages(void *mem, ulong nr)
+{
+	int i;
+
+	if (!nr)
+		return;
+
+	for (i = 0; i < nr_vfree && vfree[i].start < mem; i++)
+		;
+
+	if (i > 0 && vfree[i - 1].start + vfree[i - 1].nr * PAGE_SIZE == mem) {
+		/* extend the previous range, maybe up to the next one */
+		i--;
+		vfree[i].nr += nr;
+		if (i + 1 < nr_vfree &&
+		    vfree[i].start + vfree[i].nr * PAGE_SIZE == vfree[i + 1].start) {
+			vfree[i].nr += vfree[i + 1].nr;
+			vfree_remove(i + 1);
+		}
+	} else if (i < nr_vfree && mem + nr * PAGE_SIZE == vfree[i].start) {
+		vfree[i].start = mem;
+		vfree[i].nr += nr;
+	} else if (nr_vfree < max_vfree || vfree_grow()) {
+		memmove(&vfree[i + 1], &vfree[i], (nr_vfree - i) * sizeof(vfree[0]));
+		vfree[i].start = mem;
+		vfree[i].nr = nr;
+		nr_vfree++;
+	}
+
+	/* Give the lowest range back to the top of the stack if possible. */
+	if (nr_vfree && vfree[0].start == vfree_top) {
+		vfree_top += vfree[0].nr * PAGE_SIZE;
+		vfree_remove(0);
+	}
+}
+
+void free_vpages(void *mem, ulong nr)
+{
+	spin_lock(&lock);
+	__free_vpages(mem, nr);
+	spin_unlock(&lock);
+}
+
+/*
+ * Like alloc_vpages, but the range starts at a multiple of @align.
+ * The address space skipped for alignment is put on the free list.
+ */
+static void *alloc_vpages_aligned(ulong nr, size_t align)
+{
+	void *p, *top;
+
+	if (align <= PAGE_SIZE)
+		return alloc_vpages(nr);
+
+	spin_lock(&lock);
+	top = vfree_top;
+	p = (void *)(((uintptr_t)top - nr * PAGE_SIZE) & ~(align - 1));
+	vfree_top = p;
+	__free_vpages(p + nr * PAGE_SIZE, (top - p) / PAGE_SIZE - nr);
+	spin_unlock(&lock);
+	return p;
 }
 
 void *alloc_vpage(void)
@@ -36,48 +160,117 @@ void init_alloc_vpage(void *top)
 	vfree_top = top;
 }
 
+unsigned long __attribute__((__weak__)) vm_huge_page_sizes(void)
+{
+	return 0;
+}
+
+bool __attribute__((__weak__)) install_huge_page(pgd_t *pgtable,
+						 phys_addr_t phys, void *virt,
+						 size_t size)
+{
+	return false;
+}
+
+void vm_set_huge_pages(bool enable)
+{
+	vm_huge = enable;
+}
+
+/*
+ * Returns the largest huge page size of at most @max bytes that both
+ * @virt and @phys are aligned to, or 0 if there is none.
+ */
+static size_t huge_fit(void *virt, phys_addr_t phys, size_t max)
+{
+	unsigned long sizes = vm_huge ? vm_huge_page_sizes() : 0;
+	size_t n;
+	int b;
+
+	for (b = BITS_PER_LONG - 1; b > PAGE_SHIFT; b--) {
+		n = 1ul << b;
+		if ((sizes & n) && n <= max &&
+		    IS_ALIGNED((uintptr_t)virt, n) && IS_ALIGNED(phys, n))
+			return n;
+	}
+	return 0;
+}
+
 void *vmap(phys_addr_t phys, size_t size)
 {
 	void *mem, *p;
-	unsigned pages;
+	size_t n;
 
 	size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
-	pages = size / PAGE_SIZE;
-	mem = p = alloc_vpages(pages);
-
 	phys &= ~(unsigned long long)(PAGE_SIZE - 1);
-	while (pages--) {
-		install_page(page_root, phys, p);
-		phys += PAGE_SIZE;
-		p += PAGE_SIZE;
+	mem = alloc_vpages_aligned(size / PAGE_SIZE, huge_fit(NULL, phys, size));
+
+	/*
+	 * Virtual and physical addresses have the same alignment, so only
+	 * the tail can need 4k pages.
+	 */
+	for (p = mem; p < mem + size; p += n, phys += n) {
+		n = huge_fit(p, phys, mem + size - p);
+		if (!n || !install_huge_page(page_root, phys, p, n))
+			break;
 	}
+	if (p < mem + size)
+		install_pages(page_root, phys, mem + size - p, p);
 	return mem;
 }
 
+/*
+ * Backs @virt with a huge page if possible, trying smaller sizes when
+ * there is no free physical block large enough.  Returns the size that
+ * was mapped, or 0.
+ */
+static size_t vm_map_huge(void *virt, size_t max)
+{
+	size_t n;
+	void *page;
+
+	for (n = huge_fit(virt, 0, max); n; n = huge_fit(virt, 0, n - 1)) {
+		page = alloc_pages(get_order(n >> PAGE_SHIFT));
+		if (!page)
+			continue;
+		if (install_huge_page(page_root, virt_to_phys(page), virt, n))
+			break;
+		free_pages(page, n);
+	}
+	return n;
+}
+
 static void *vm_memalign(size_t alignment, size_t size)
 {
 	void *mem, *p;
-	unsigned pages;
+	size_t n;
 
 	assert(alignment <= PAGE_SIZE);
 	size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
-	pages = size / PAGE_SIZE;
-	mem = p = alloc_vpages(pages);
-	while (pages--) {
-		phys_addr_t pa = virt_to_phys(alloc_page());
-		install_page(page_root, pa, p);
-		p += PAGE_SIZE;
+	mem = alloc_vpages_aligned(size / PAGE_SIZE, huge_fit(NULL, 0, size));
+
+	for (p = mem; p < mem + size; p += n) {
+		n = vm_map_huge(p, mem + size - p);
+		if (!n) {
+			install_page(page_root, virt_to_phys(alloc_page()), p);
+			n = PAGE_SIZE;
+		}
 	}
 	return mem;
 }
 
 static void vm_free(void *mem, size_t size)
 {
-	while (size) {
-		free_page(phys_to_virt(virt_to_pte_phys(page_root, mem)));
-		mem += PAGE_SIZE;
-		size -= PAGE_SIZE;
+	phys_addr_t pa;
+	size_t n;
+	void *p;
+
+	for (p = mem; p < mem + size; p += n) {
+		pa = virt_to_pte_phys(page_root, p);
+		n = unmap_page(page_root, p);
+		free_pages_by_order(phys_to_virt(pa), get_order(n >> PAGE_SHIFT));
 	}
+	free_vpages(mem, size / PAGE_SIZE);
 }
 
 static struct alloc_ops vmalloc_ops = {
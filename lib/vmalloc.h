@@ -5,12 +5,33 @@
 
 extern void *alloc_vpages(ulong nr);
 extern void *alloc_vpage(void);
+extern void free_vpages(void *mem, ulong nr);
 extern void init_alloc_vpage(void *top);
 extern void setup_vm(void);
 
 extern void *setup_mmu(phys_addr_t top);
 extern phys_addr_t virt_to_pte_phys(pgd_t *pgtable, void *virt);
 extern pteval_t *install_page(pgd_t *pgtable, phys_addr_t phys, void *virt);
+/* Like install_page for @len bytes, walking the page tables less often. */
+extern void install_pages(pgd_t *pgtable, phys_addr_t phys, size_t len,
+			  void *virt);
+/*
+ * Removes the mapping of @virt installed by install_page or
+ * install_huge_page and returns its size.  Page table pages that become
+ * empty may be freed.
+ */
+extern size_t unmap_page(pgd_t *pgtable, void *virt);
+
+/*
+ * Optionally implemented by the architecture: vm_huge_page_sizes returns
+ * a mask of the block sizes that install_huge_page can map with a single
+ * entry.  vmalloc and vmap use them automatically for suitably aligned,
+ * physically contiguous memory unless vm_set_huge_pages(false) is called.
+ */
+extern unsigned long vm_huge_page_sizes(void);
+extern bool install_huge_page(pgd_t *pgtable, phys_addr_t phys, void *virt,
+			      size_t size);
+extern void vm_set_huge_pages(bool enable);
 
 void *vmap(phys_addr_t phys, size_t size);
 
@@ -0,0 +1,92 @@
+/*
+ * Per-CPU work queues, see work_queue.h
+ *
+ * Producers claim a slot by advancing @head with a compare-and-swap, fill
+ * it and then publish it by bumping the slot's @turn.  The owning CPU
+ * consumes slots in order and hands them back for the next lap, so
+ * producers never wait for each other, only for a full ring.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.
+ */
+#include <libcflat.h>
+#include <linux/compiler.h>
+#include <asm/barrier.h>
+#include "work_queue.h"
+
+static unsigned long lap(unsigned long pos)
+{
+	return pos / WORK_QUEUE_SIZE * 2;
+}
+
+bool work_queue_push(struct work_queue *wq, void (*func)(void *data),
+		     void *data, struct completion *done)
+{
+	unsigned long pos;
+	struct work *w;
+
+	for (;;) {
+		pos = wq->head;
+		w = &wq->slots[pos % WORK_QUEUE_SIZE];
+		if (w->turn != lap(pos)) {
+			/* Still in use on the previous lap? */
+			if ((long)(w->turn - lap(pos)) < 0)
+				return false;
+			continue;
+		}
+		if (__sync_bool_compare_and_swap(&wq->head, pos, pos + 1))
+			break;
+	}
+
+	w->func = func;
+	w->data = data;
+	w->done = done;
+	if (done)
+		__sync_fetch_and_add(&done->pending, 1);
+	smp_wmb();
+	w->turn = lap(pos) + 1;
+	return true;
+}
+
+int work_queue_run(struct work_queue *wq)
+{
+	struct completion *done;
+	void (*func)(void *data);
+	struct work *w;
+	void *data;
+	int n = 0;
+
+	for (;;) {
+		w = &wq->slots[wq->tail % WORK_QUEUE_SIZE];
+		if (w->turn != lap(wq->tail) + 1)
+			return n;
+		smp_rmb();
+		func = w->func;
+		data = w->data;
+		done = w->done;
+		smp_mb();
+		w->turn = lap(wq->tail) + 2;
+		wq->tail++;
+
+		func(data);
+		if (done)
+			complete(done);
+		n++;
+	}
+}
+
+bool work_queue_empty(struct work_queue *wq)
+{
+	return wq->slots[wq->tail % WORK_QUEUE_SIZE].turn != lap(wq->tail) + 1;
+}
+
+void complete(struct completion *c)
+{
+	__sync_fetch_and_sub(&c->pending, 1);
+}
+
+void wait_for_completion(struct completion *c)
+{
+	while (!completion_done(c))
+		cpu_relax();
+	smp_rmb();
+}
@@ -0,0 +1,85 @@
+#ifndef _WORK_QUEUE_H_
+#define _WORK_QUEUE_H_
+/*
+ * Per-CPU work queues
+ *
+ * A work queue is a bounded ring of jobs which any number of CPUs may
+ * post to without taking a lock, and which is drained by its owning
+ * CPU only.  The architecture's smp code provides one queue per CPU,
+ * posts to it with queue_work() and drains it from its IPI handler or
+ * idle loop.
+ *
+ * Each job may be tied to a completion.  A completion counts the jobs
+ * still pending, so a single completion can track one job or act as a
+ * barrier for a whole group of jobs spread over many CPUs.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.
+ */
+#include <libcflat.h>
+
+#define WORK_QUEUE_SIZE		32
+
+struct completion {
+	volatile unsigned int pending;
+};
+
+struct work {
+	/*
+	 * Twice the lap the slot is on, plus one while it holds a job
+	 * that has not run yet, so that an all zero queue is empty.
+	 */
+	volatile unsigned long turn;
+	void (*func)(void *data);
+	void *data;
+	struct completion *done;
+};
+
+struct work_queue {
+	volatile unsigned long head;	/* next slot to fill */
+	unsigned long tail __attribute__((aligned(64)));
+	struct work slots[WORK_QUEUE_SIZE];
+} __attribute__((aligned(64)));
+
+static inline void completion_init(struct completion *c)
+{
+	c->pending = 0;
+}
+
+static inline bool completion_done(struct completion *c)
+{
+	return c->pending == 0;
+}
+
+/*
+ * work_queue_push adds @func(@data) to @wq and accounts for it in @done,
+ * which may be NULL.  Returns false if the queue is full.
+ */
+extern bool work_queue_push(struct work_queue *wq, void (*func)(void *data),
+			    void *data, struct completion *done);
+
+/*
+ * work_queue_run runs all jobs in @wq, it must only be called by the
+ * CPU owning the queue.  Returns the number of jobs run.
+ */
+extern int work_queue_run(struct work_queue *wq);
+
+extern bool work_queue_empty(struct work_queue *wq);
+
+/*
+ * complete marks one job of @c as finished, it is called for every job
+ * run from a queue and may also be used for work tracked by hand.
+ */
+extern void complete(struct completion *c);
+
+/* wait_for_completion waits until all jobs accounted in @c have run. */
+extern void wait_for_completion(struct completion *c);
+
+/*
+ * queue_work posts @func(@data) to @cpu's work queue without waiting
+ * for it to run.  Jobs posted to the same CPU run in order.  If @cpu is
+ * the calling CPU, the job runs immediately.  Provided by the arch.
+ */
+extern void queue_work(int cpu, void (*func)(void *data), void *data,
+		       struct completion *done);
+
+#endif
@@ -10,8 +10,9 @@
 #define rmb()	asm volatile("lfence":::"memory")
 #define wmb()	asm volatile("sfence":::"memory")
 
-#define smp_rmb()	barrier()
-#define smp_wmb()	barrier()
+#define smp_mb()	mb()
+#define smp_rmb()	asm volatile("":::"memory")
+#define smp_wmb()	asm volatile("":::"memory")
 
 /* REP NOP (PAUSE) is a good thing to insert into busy-wait loops. */
 static inline void rep_nop(void)
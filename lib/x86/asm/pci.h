@@ -50,6 +50,11 @@ static inline void pci_config_writel(pcidevaddr_t dev, uint8_t reg,
     outl(val, 0xCFC);
 }
 
+static inline bool pci_available(void)
+{
+    return true;
+}
+
 static inline
 phys_addr_t pci_translate_addr(pcidevaddr_t dev __unused, uint64_t addr)
 {
@@ -1,5 +1,9 @@
 #include "delay.h"
 #include "processor.h"
+#include "acpi.h"
+#include "asm/io.h"
+
+#define PM_TIMER_HZ	3579545
 
 void delay(u64 count)
 {
@@ -9,3 +13,29 @@ void delay(u64 count)
 		pause();
 	} while (rdtsc() - start < count);
 }
+
+u64 tsc_hz(void)
+{
+	static u64 hz;
+	struct fadt_descriptor_rev1 *fadt;
+	u32 port, t0, ticks;
+	u64 tsc0, tsc1;
+
+	if (hz)
+		return hz;
+
+	fadt = find_acpi_table_addr(FACP_SIGNATURE);
+	assert(fadt && fadt->pm_tmr_blk);
+	port = fadt->pm_tmr_blk;
+
+	/* 10ms of the 24-bit PM timer */
+	t0 = inl(port);
+	tsc0 = rdtsc();
+	do {
+		ticks = (inl(port) - t0) & 0xffffff;
+	} while (ticks < PM_TIMER_HZ / 100);
+	tsc1 = rdtsc();
+
+	hz = (tsc1 - tsc0) * PM_TIMER_HZ / ticks;
+	return hz;
+}
@@ -7,6 +7,12 @@
 
 void delay(u64 count);
 
+/*
+ * tsc_hz returns the TSC frequency, measured against the ACPI PM timer
+ * the first time it is called.
+ */
+u64 tsc_hz(void);
+
 static inline void io_delay(void)
 {
 	delay(IPI_DELAY);
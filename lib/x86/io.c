@@ -11,6 +11,21 @@ static struct spinlock lock;
 static int serial_iobase = 0x3f8;
 static int serial_inited = 0;
 
+#ifdef CONFIG_DEBUGCON
+/*
+ * The isa-debugcon takes a whole buffer with one rep outsb, instead of
+ * two exits per character for the 16550.  It reads back as 0xe9 if
+ * present, otherwise output falls back to the serial port.
+ */
+static int debugcon_iobase = 0xe9;
+static bool use_debugcon;
+
+static void debugcon_init(void)
+{
+        use_debugcon = inb(debugcon_iobase) == 0xe9;
+}
+#endif
+
 static void serial_outb(char ch)
 {
         u8 lsr;
@@ -65,9 +80,19 @@ static void print_serial(const char *buf)
         unsigned long i;
         if (!serial_inited) {
             serial_init();
+#ifdef CONFIG_DEBUGCON
+            debugcon_init();
+#endif
             serial_inited = 1;
         }
 
+#ifdef CONFIG_DEBUGCON
+        if (use_debugcon) {
+            asm volatile ("rep/outsb" : "+S"(buf), "+c"(len)
+                          : "d"(debugcon_iobase) : "memory");
+            return;
+        }
+#endif
         for (i = 0; i < len; i++) {
             serial_put(buf[i]);
         }
@@ -6,35 +6,77 @@
 #include "apic.h"
 #include "fwcfg.h"
 #include "desc.h"
+#include "alloc_page.h"
+#include "asm/barrier.h"
+#include "work_queue.h"
 
 #define IPI_VECTOR 0x20
 
 typedef void (*ipi_function_type)(void *data);
 
-static struct spinlock ipi_lock;
-static volatile ipi_function_type ipi_function;
-static void *volatile ipi_data;
-static volatile int ipi_done;
-static volatile bool ipi_wait;
+/*
+ * Work for a CPU is posted in its mailbox, indexed by APIC ID, so that
+ * several CPUs can be started at once.  @busy is taken by the sender and
+ * released by the target once it has copied the request, @posted tells
+ * the target that the request is complete.  @done, if not NULL, is
+ * decremented after the function has run.
+ */
+struct ipi_mailbox {
+    volatile int busy;
+    volatile int posted;
+    ipi_function_type function;
+    void *data;
+    atomic_t *done;
+    bool wait;
+} __attribute__((aligned(64)));
+
+static struct ipi_mailbox mailboxes[MAX_TEST_CPUS];
+
+/*
+ * Work queues are also indexed by APIC ID and drained by the IPI handler.
+ * @kicked is set while an IPI for the queue is in flight so that posting
+ * a batch of jobs does not send an IPI for each one.
+ */
+static struct work_queue work_queues[MAX_TEST_CPUS];
+static volatile int kicked[MAX_TEST_CPUS];
 static int _cpu_count;
 static atomic_t active_cpus;
+static volatile bool idle_prezero;
 
 static __attribute__((used)) void ipi(void)
 {
-    void (*function)(void *data) = ipi_function;
-    void *data = ipi_data;
-    bool wait = ipi_wait;
+    unsigned int id = apic_id();
+    struct ipi_mailbox *mb = &mailboxes[id];
+    ipi_function_type function;
+    atomic_t *done;
+    bool wait;
+    void *data;
 
-    if (!wait) {
-	ipi_done = 1;
-	apic_write(APIC_EOI, 0);
-    }
-    function(data);
-    atomic_dec(&active_cpus);
-    if (wait) {
-	ipi_done = 1;
+    if (mb->posted) {
+	function = mb->function;
+	data = mb->data;
+	done = mb->done;
+	wait = mb->wait;
+	mb->posted = 0;
+	barrier();
+	mb->busy = 0;
+
+	if (!wait)
+	    apic_write(APIC_EOI, 0);
+	function(data);
+	atomic_dec(&active_cpus);
+	if (done)
+	    atomic_dec(done);
+	if (wait)
+	    apic_write(APIC_EOI, 0);
+    } else {
 	apic_write(APIC_EOI, 0);
     }
+
+    /* A kick may have been merged with the IPI for the mailbox. */
+    kicked[id] = 0;
+    smp_mb();
+    work_queue_run(&work_queues[id]);
 }
 
 asm (
@@ -60,31 +102,97 @@ int smp_id(void)
     return id;
 }
 
+/* The index of the calling CPU in id_map, i.e. its number for on_cpu(). */
+int smp_cpu_index(void)
+{
+    int cpu, id = smp_id();
+
+    for (cpu = 0; cpu < _cpu_count; ++cpu)
+	if (id_map[cpu] == id)
+	    return cpu;
+    assert(0);
+    return 0;
+}
+
+int page_alloc_cpu(void)
+{
+    return smp_id();
+}
+
+/*
+ * The APs run this in a loop while they wait for work.  Interrupts are
+ * off while they zero pages, the IPI handlers may allocate pages too.
+ */
+void ap_idle(void)
+{
+    if (!idle_prezero) {
+	safe_halt();
+	return;
+    }
+
+    irq_disable();
+    page_alloc_prezero(16);
+    irq_enable();
+    pause();
+}
+
+static void nop(void *data)
+{
+}
+
+/*
+ * Lets the APs zero free pages ahead of time with page_alloc_prezero()
+ * instead of halting while they are idle.  Once this returns with
+ * @enable false, none of them is zeroing anymore.
+ */
+void smp_idle_prezero(bool enable)
+{
+    idle_prezero = enable;
+    /* Get them out of hlt, or wait for them to leave the zeroing loop. */
+    on_cpus(nop, NULL);
+}
+
 static void setup_smp_id(void *data)
 {
     asm ("mov %0, %%gs:0" : : "r"(apic_id()) : "memory");
 }
 
+/* Fills the mailbox of APIC ID @target, the caller sends the IPI. */
+static void post(unsigned int target, void (*function)(void *data),
+                 void *data, atomic_t *done, bool wait)
+{
+    struct ipi_mailbox *mb = &mailboxes[target];
+
+    assert(target < MAX_TEST_CPUS);
+    while (__sync_lock_test_and_set(&mb->busy, 1))
+	pause();
+
+    atomic_inc(&active_cpus);
+    mb->function = function;
+    mb->data = data;
+    mb->done = done;
+    mb->wait = wait;
+    barrier();
+    mb->posted = 1;
+}
+
 static void __on_cpu(int cpu, void (*function)(void *data), void *data,
                      int wait)
 {
     unsigned int target = id_map[cpu];
+    atomic_t done;
 
-    spin_lock(&ipi_lock);
-    if (target == smp_id())
+    if (target == smp_id()) {
 	function(data);
-    else {
-	atomic_inc(&active_cpus);
-	ipi_done = 0;
-	ipi_function = function;
-	ipi_data = data;
-	ipi_wait = wait;
-	apic_icr_write(APIC_INT_ASSERT | APIC_DEST_PHYSICAL | APIC_DM_FIXED
-                       | IPI_VECTOR, target);
-	while (!ipi_done)
-	    ;
+	return;
     }
-    spin_unlock(&ipi_lock);
+
+    atomic_set(&done, 1);
+    post(target, function, data, wait ? &done : NULL, wait);
+    apic_icr_write(APIC_INT_ASSERT | APIC_DEST_PHYSICAL | APIC_DM_FIXED
+                   | IPI_VECTOR, target);
+    while (wait && atomic_read(&done))
+	pause();
 }
 
 void on_cpu(int cpu, void (*function)(void *data), void *data)
@@ -97,15 +205,55 @@ void on_cpu_async(int cpu, void (*function)(void *data), void *data)
     __on_cpu(cpu, function, data, 0);
 }
 
+/*
+ * Starts all other CPUs with a single broadcast IPI, then runs @function
+ * locally and waits for the others to finish.
+ */
 void on_cpus(void (*function)(void *data), void *data)
 {
-    int cpu;
+    int cpu, self = smp_id();
+    atomic_t done;
+
+    atomic_set(&done, cpu_count() - 1);
+    for (cpu = 0; cpu < cpu_count(); ++cpu)
+	if (id_map[cpu] != self)
+	    post(id_map[cpu], function, data, &done, false);
+    if (cpu_count() > 1)
+	apic_icr_write(APIC_INT_ASSERT | APIC_DEST_ALLBUT | APIC_DM_FIXED
+		       | IPI_VECTOR, 0);
+
+    function(data);
+
+    while (atomic_read(&done))
+	pause();
+}
+
+static void kick(unsigned int target)
+{
+    if (!__sync_lock_test_and_set(&kicked[target], 1))
+	apic_icr_write(APIC_INT_ASSERT | APIC_DEST_PHYSICAL | APIC_DM_FIXED
+		       | IPI_VECTOR, target);
+}
+
+/*
+ * The jobs run in the target's IPI handler, so the target must have
+ * interrupts enabled or be waiting for work with sti/hlt.
+ */
+void queue_work(int cpu, void (*func)(void *data), void *data,
+		struct completion *done)
+{
+    unsigned int target = id_map[cpu];
 
-    for (cpu = cpu_count() - 1; cpu >= 0; --cpu)
-        on_cpu_async(cpu, function, data);
+    if (target == smp_id()) {
+	func(data);
+	return;
+    }
 
-    while (cpus_active() > 1)
-        pause();
+    while (!work_queue_push(&work_queues[target], func, data, done)) {
+	kick(target);
+	pause();
+    }
+    kick(target);
 }
 
 int cpus_active(void)
@@ -115,7 +263,6 @@ int cpus_active(void)
 
 void smp_init(void)
 {
-    int i;
     void ipi_entry(void);
 
     _cpu_count = fwcfg_get_nb_cpus();
@@ -125,8 +272,7 @@ void smp_init(void)
     set_idt_entry(IPI_VECTOR, ipi_entry, 0);
 
     setup_smp_id(0);
-    for (i = 1; i < cpu_count(); ++i)
-        on_cpu(i, setup_smp_id, 0);
+    on_cpus(setup_smp_id, 0);
 
     atomic_inc(&active_cpus);
 }
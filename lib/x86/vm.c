@@ -18,7 +18,7 @@ pteval_t *install_pte(pgd_t *cr3,
 	if (!(pt[offset] & PT_PRESENT_MASK)) {
 	    pteval_t *new_pt = pt_page;
             if (!new_pt)
-                new_pt = alloc_page();
+                new_pt = alloc_pages_flags(0, ALLOC_NOZERO);
             else
                 pt_page = 0;
 	    memset(new_pt, 0, PAGE_SIZE);
@@ -100,18 +100,110 @@ pteval_t *install_page(pgd_t *cr3, phys_addr_t phys, void *virt)
     return install_pte(cr3, 1, virt, phys | PT_PRESENT_MASK | PT_WRITABLE_MASK | PT_USER_MASK, 0);
 }
 
+unsigned long vm_huge_page_sizes(void)
+{
+#ifdef __x86_64__
+    if (this_cpu_has(X86_FEATURE_GBPAGES))
+	return LARGE_PAGE_SIZE | (1ul << 30);
+#endif
+    return LARGE_PAGE_SIZE;
+}
+
+bool install_huge_page(pgd_t *cr3, phys_addr_t phys, void *virt, size_t size)
+{
+    int level;
+
+    /* 2M/4M pages are PDEs, 1G pages PDPTEs */
+    for (level = 2; level <= MIN(PAGE_LEVEL, 3); level++)
+	if (size == 1ul << PGDIR_BITS(level))
+	    break;
+    if (level > MIN(PAGE_LEVEL, 3))
+	return false;
+
+    install_pte(cr3, level, virt,
+		phys | PT_PRESENT_MASK | PT_WRITABLE_MASK | PT_USER_MASK | PT_PAGE_SIZE_MASK, 0);
+    return true;
+}
+
+/*
+ * Fills the level @pte_level PTEs for [virt, virt + len), starting with
+ * @pte and adding @step for every following entry.  The page tables are
+ * walked from the root only once per page table page.
+ */
+void install_pte_range(pgd_t *cr3, int pte_level, void *virt, size_t len,
+		       pteval_t pte, pteval_t step)
+{
+	size_t size = 1ul << PGDIR_BITS(pte_level);
+	pteval_t *ptep;
+	unsigned i, n;
+
+	assert((uintptr_t)virt % size == 0);
+	assert(len % size == 0);
+
+	while (len) {
+		n = MIN(PGDIR_MASK + 1 - PGDIR_OFFSET((uintptr_t)virt, pte_level),
+			len / size);
+		ptep = install_pte(cr3, pte_level, virt, pte, 0);
+		for (i = 1; i < n; i++)
+			ptep[i] = pte + i * step;
+		pte += n * step;
+		virt = (char *) virt + n * size;
+		len -= n * size;
+	}
+}
+
 void install_pages(pgd_t *cr3, phys_addr_t phys, size_t len, void *virt)
 {
-	phys_addr_t max = (u64)len + (u64)phys;
 	assert(phys % PAGE_SIZE == 0);
-	assert((uintptr_t) virt % PAGE_SIZE == 0);
-	assert(len % PAGE_SIZE == 0);
 
-	while (phys + PAGE_SIZE <= max) {
-		install_page(cr3, phys, virt);
-		phys += PAGE_SIZE;
-		virt = (char *) virt + PAGE_SIZE;
+	install_pte_range(cr3, 1, virt, len,
+			  phys | PT_PRESENT_MASK | PT_WRITABLE_MASK | PT_USER_MASK,
+			  PAGE_SIZE);
+}
+
+/*
+ * Clears the leaf PTE of @virt and, for 4k pages, frees the page table
+ * pages that are left empty.  Only the local TLB is flushed.  Returns
+ * the size of the mapping that was removed.
+ */
+size_t unmap_page(pgd_t *cr3, void *virt)
+{
+    pteval_t *pt[PAGE_LEVEL + 1], *ptep;
+    unsigned offset, i;
+    int level;
+
+    pt[PAGE_LEVEL] = cr3;
+    for (level = PAGE_LEVEL; level > 1; --level) {
+	ptep = &pt[level][PGDIR_OFFSET((uintptr_t)virt, level)];
+
+	if (!(*ptep & PT_PRESENT_MASK))
+	    return PAGE_SIZE;
+	if (*ptep & PT_PAGE_SIZE_MASK) {
+	    *ptep = 0;
+	    invlpg(virt);
+	    return 1ul << PGDIR_BITS(level);
 	}
+	pt[level - 1] = phys_to_virt(*ptep & PT_ADDR_MASK);
+    }
+
+    for (level = 1; level < PAGE_LEVEL; ++level) {
+	offset = PGDIR_OFFSET((uintptr_t)virt, level);
+	pt[level][offset] = 0;
+	if (level > 1)
+	    free_page(pt[level - 1]);
+
+	/*
+	 * Ranges are usually freed from bottom to top, so look at the
+	 * entries above this one first.
+	 */
+	for (i = 1; i <= PGDIR_MASK; i++)
+	    if (pt[level][(offset + i) & PGDIR_MASK])
+		break;
+	if (i <= PGDIR_MASK)
+	    break;
+    }
+    invlpg(virt);
+    return PAGE_SIZE;
 }
 
 bool any_present_pages(pgd_t *cr3, void *virt, size_t len)
@@ -129,19 +221,19 @@ bool any_present_pages(pgd_t *cr3, void *virt, size_t len)
 
 static void setup_mmu_range(pgd_t *cr3, phys_addr_t start, size_t len)
 {
-	u64 max = (u64)len + (u64)start;
-	u64 phys = start;
-
-	while (phys + LARGE_PAGE_SIZE <= max) {
-		install_large_page(cr3, phys, (void *)(ulong)phys);
-		phys += LARGE_PAGE_SIZE;
-	}
-	install_pages(cr3, phys, max - phys, (void *)(ulong)phys);
+	size_t large = len & ~(LARGE_PAGE_SIZE - 1);
+
+	assert(start % LARGE_PAGE_SIZE == 0);
+	install_pte_range(cr3, 2, (void *)(ulong)start, large,
+			  start | PT_PRESENT_MASK | PT_WRITABLE_MASK |
+			  PT_USER_MASK | PT_PAGE_SIZE_MASK, LARGE_PAGE_SIZE);
+	install_pages(cr3, start + large, len - large,
+		      (void *)(ulong)(start + large));
 }
 
 void *setup_mmu(phys_addr_t end_of_memory)
 {
-    pgd_t *cr3 = alloc_page();
+    pgd_t *cr3 = alloc_pages_flags(0, ALLOC_NOZERO);
 
     memset(cr3, 0, PAGE_SIZE);
 
@@ -175,7 +267,11 @@ void *setup_mmu(phys_addr_t end_of_memory)
 
 phys_addr_t virt_to_pte_phys(pgd_t *cr3, void *mem)
 {
-    return (*get_pte(cr3, mem) & PT_ADDR_MASK) + ((ulong)mem & (PAGE_SIZE - 1));
+    struct pte_search search = find_pte_level(cr3, mem, 1);
+    ulong mask = (1ul << PGDIR_BITS(search.level)) - 1;
+
+    assert(found_leaf_pte(search));
+    return (*search.pte & PT_ADDR_MASK & ~(phys_addr_t)mask) + ((ulong)mem & mask);
 }
 
 /*
@@ -196,7 +292,8 @@ void split_large_page(unsigned long *ptep, int level)
 	assert(pte & PT_PAGE_SIZE_MASK);
 	assert(level == 2 || level == 3);
 
-	new_pt = alloc_page();
+	/* Every entry is filled in below. */
+	new_pt = alloc_pages_flags(0, ALLOC_NOZERO);
 	assert(new_pt);
 
 	prototype = pte & ~PT_ADDR_MASK;
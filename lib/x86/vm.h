@@ -34,6 +34,8 @@ pteval_t *install_pte(pgd_t *cr3,
 		      pteval_t pte,
 		      pteval_t *pt_page);
 
+void install_pte_range(pgd_t *cr3, int pte_level, void *virt, size_t len,
+		       pteval_t pte, pteval_t step);
 pteval_t *install_large_page(pgd_t *cr3, phys_addr_t phys, void *virt);
 void install_pages(pgd_t *cr3, phys_addr_t phys, size_t len, void *virt);
 bool any_present_pages(pgd_t *cr3, void *virt, size_t len);
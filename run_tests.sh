@@ -16,6 +16,7 @@ function usage()
 cat <<EOF
 
 Usage: $0 [-h] [-v] [-a] [-g group] [-j NUM-TASKS] [-t]
+          [-b BASELINE] [-s BASELINE]
 
     -h, --help      Output this help text
     -v, --verbose   Enables verbose mode
@@ -24,10 +25,37 @@ Usage: $0 [-h] [-v] [-a] [-g group] [-j NUM-TASKS] [-t]
     -g, --group     Only execute tests in the given group
     -j, --parallel  Execute tests in parallel
     -t, --tap13     Output test results in TAP format
+    -b, --baseline  Compare benchmark results against the given baseline
+                    file and fail if any of them regressed or is missing
+    -s, --save-baseline
+                    Save the benchmark results of this run as baseline
 
 Set the environment variable QEMU=/path/to/qemu-system-ARCH to
 specify the appropriate qemu binary for ARCH-run.
 
+With -j, unittests.cfg entries with shards = <num> are split into up
+to that many instances of about the same duration, using the test
+durations in logs/BENCHMARKS of the previous run, or in the file named
+by TEST_DURATIONS.
+
+Benchmark results (BENCH: records, see lib/bench.h) of all tests
+are collected in logs/BENCHMARKS.  When comparing against a baseline,
+BENCH_METRICS lists the metrics that are compared (default "mean p50
+p99") and BENCH_TOLERANCE is the allowed slowdown in percent (default
+10).  Lower values are better, except for the units listed in
+BENCH_HIGHER_UNITS (default "iops pps permille").  Tolerances for
+single records or metrics can be set in the baseline file with
+tolerance=<pct> or tolerance.<metric>=<pct>.  A baseline record that
+is missing from the results also fails the comparison, unless
+BENCH_ALLOW_MISSING=1 is set, e.g. when only some tests are run.
+The duration and VM exit counts of each vmx and svm test (TEST_STATS:
+records) are collected in logs/TEST_STATS.
+
+REPORT_VERBOSITY is passed to the tests and sets how many PASS results
+they print: 2 (default) prints all of them, 1 only the last few before
+a failure, 0 none.  access.flat also takes it as verbosity=N, vmx.flat
+and svm.flat as --verbosity=N.
+
 EOF
 }
 
@@ -35,7 +63,9 @@ RUNTIME_arch_run="./$TEST_DIR/run"
 source scripts/runtime.bash
 
 only_tests=""
-args=`getopt -u -o ag:htj:v -l all,group:,help,tap13,parallel:,verbose -- $*`
+bench_baseline=""
+bench_save_baseline=""
+args=`getopt -u -o ab:g:htj:s:v -l all,baseline:,group:,help,tap13,parallel:,save-baseline:,verbose -- $*`
 [ $? -ne 0 ] && exit 2;
 set -- $args;
 while [ $# -gt 0 ]; do
@@ -44,6 +74,14 @@ while [ $# -gt 0 ]; do
             run_all_tests="yes"
             export ERRATA_FORCE=y
             ;;
+        -b | --baseline)
+            shift
+            bench_baseline=$1
+            if [ ! -f "$bench_baseline" ]; then
+                echo "Baseline file $bench_baseline not found"
+                exit 2
+            fi
+            ;;
         -g | --group)
             shift
             only_group=$1
@@ -60,6 +98,10 @@ while [ $# -gt 0 ]; do
                 exit 2
             fi
             ;;
+        -s | --save-baseline)
+            shift
+            bench_save_baseline=$1
+            ;;
         -v | --verbose)
             verbose="yes"
             ;;
@@ -123,19 +165,17 @@ RUNTIME_log_stdout () {
     fi
 }
 
-function run_task()
+function start_task()
 {
-	local testname="$1"
-	if [ -z "$testname" ]; then
-		return
-	fi
+	local logname="$1"
+	shift
 
 	while (( $(jobs | wc -l) == $unittest_run_queues )); do
 		# wait for any background test to finish
 		wait -n 2>/dev/null
 	done
 
-	RUNTIME_log_file="${unittest_log_dir}/${testname}.log"
+	RUNTIME_log_file="${unittest_log_dir}/${logname}.log"
 	if [ $unittest_run_queues = 1 ]; then
 		run "$@"
 	else
@@ -143,6 +183,38 @@ function run_task()
 	fi
 }
 
+function run_task()
+{
+	local testname="$1"
+	local shards="${10}"
+	local masks mask
+	local i=0
+
+	if [ -z "$testname" ]; then
+		return
+	fi
+
+	# Entries with shards = <num> run as several instances under -j, each
+	# with a part of the tests.  Leave those run() skips to run().
+	if [ -n "$shards" ] && (( unittest_run_queues > 1 )) &&
+	   { [ -z "$only_tests" ] || grep -qw "$testname" <<<$only_tests; } &&
+	   { [ -z "$only_group" ] || grep -qw "$only_group" <<<$2; } &&
+	   { [ -z "$6" ] || [ "$6" = "$ARCH" ]; }; then
+		masks=$(plan_shards "$@")
+	fi
+
+	if [ -z "$masks" ]; then
+		start_task "$testname" "$@"
+		return
+	fi
+
+	for mask in $masks; do
+		start_task "$testname.shard$i" "$testname.shard$i" "$2" "$3" "$4" \
+			"$(prepend_append_args "$5" "--select=$mask")" "${@:6}"
+		i=$((i + 1))
+	done
+}
+
 : ${unittest_log_dir:=logs}
 : ${unittest_run_queues:=1}
 config=$TEST_DIR/unittests.cfg
@@ -168,3 +240,28 @@ trap "wait; exit 130" SIGINT
 
 # wait until all tasks finish
 wait
+
+collect_bench_results $unittest_log_dir > $unittest_log_dir/BENCHMARKS
+collect_test_stats $unittest_log_dir > $unittest_log_dir/TEST_STATS
+
+if [ -n "$bench_save_baseline" ]; then
+    cp $unittest_log_dir/BENCHMARKS "$bench_save_baseline"
+fi
+
+if [ -n "$bench_baseline" ]; then
+    compare_bench_results "$bench_baseline" $unittest_log_dir/BENCHMARKS \
+        > $unittest_log_dir/BENCH_COMPARE
+    bench_ret=$?
+    bench_summary="($(tail -1 $unittest_log_dir/BENCH_COMPARE))"
+    if [[ $tap_output == "yes" ]]; then
+        sed 's/^/# /' $unittest_log_dir/BENCH_COMPARE
+    else
+        grep -v '^[0-9]' $unittest_log_dir/BENCH_COMPARE
+        if [ $bench_ret -eq 0 ]; then
+            print_result "PASS" bench_baseline "$bench_summary"
+        else
+            print_result "FAIL" bench_baseline "$bench_summary"
+        fi
+    fi
+    exit $bench_ret
+fi
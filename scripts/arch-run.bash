@@ -248,6 +248,10 @@ env_params ()
 	! [[ $KERNEL_SUBLEVEL =~ ^[0-9]+$ ]] && unset $KERNEL_SUBLEVEL
 	! [[ $KERNEL_EXTRAVERSION =~ ^[0-9]+$ ]] && unset $KERNEL_EXTRAVERSION
 	env_add_params KERNEL_VERSION_STRING KERNEL_VERSION KERNEL_PATCHLEVEL KERNEL_SUBLEVEL KERNEL_EXTRAVERSION
+
+	if [ "$REPORT_VERBOSITY" ]; then
+		env_add_params REPORT_VERBOSITY
+	fi
 }
 
 env_file ()
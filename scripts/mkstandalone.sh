@@ -43,6 +43,7 @@ generate_test ()
 	config_export ARCH
 	config_export ARCH_NAME
 	config_export PROCESSOR
+	config_export CONSOLE
 
 	echo "echo BUILD_HEAD=$(cat build-head)"
 
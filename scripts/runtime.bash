@@ -1,6 +1,10 @@
 : "${RUNTIME_arch_run?}"
 : ${MAX_SMP:=$(getconf _NPROCESSORS_ONLN)}
 : ${TIMEOUT:=90s}
+: ${BENCH_TOLERANCE:=10}
+: ${BENCH_METRICS:="mean p50 p99"}
+: ${BENCH_HIGHER_UNITS:="iops pps permille"}
+: ${BENCH_ALLOW_MISSING:=}
 
 PASS() { echo -ne "\e[32mPASS\e[0m"; }
 SKIP() { echo -ne "\e[33mSKIP\e[0m"; }
@@ -84,7 +88,7 @@ function run()
         return
     fi
 
-    if [ -n "$only_tests" ] && ! grep -qw "$testname" <<<$only_tests; then
+    if [ -n "$only_tests" ] && ! grep -qw "${testname%.shard*}" <<<$only_tests; then
         return
     fi
 
@@ -158,6 +162,232 @@ function run()
     return $ret
 }
 
+# Collect the BENCH: records printed by the benchmark tests (see lib/bench.h)
+# from all test logs in the given directory.  Each record is prefixed with
+# the name of the unittests.cfg entry that produced it.
+collect_bench_results()
+{
+    local log_dir="$1"
+    local cr=$'\r'
+    local log testname
+
+    for log in "$log_dir"/*.log; do
+        [ -f "$log" ] || continue
+        testname=$(basename "$log" .log)
+        sed -n "s/$cr\$//; s/^BENCH: /test=$testname /p" "$log"
+    done
+}
+
+# Collect the TEST_STATS: records, with the duration and the VM exits by
+# exit reason of each nested virtualization test, in the same way.
+collect_test_stats()
+{
+    local log_dir="$1"
+    local cr=$'\r'
+    local log testname
+
+    for log in "$log_dir"/*.log; do
+        [ -f "$log" ] || continue
+        testname=$(basename "$log" .log)
+        sed -n "s/$cr\$//; s/^TEST_STATS: /test=$testname /p" "$log"
+    done
+}
+
+# Compare the benchmark results of this run against a baseline file written
+# by a previous run.  Higher values are better for records whose unit is
+# listed in $BENCH_HIGHER_UNITS (throughputs and ratios), lower values for
+# all others; a metric regresses when it is more than the tolerance (in
+# percent) worse than the baseline.  The default tolerance is $BENCH_TOLERANCE, it can be changed
+# for single records in the baseline file with tolerance=<pct>, and for
+# single metrics of a record with tolerance.<metric>=<pct>.  The metrics
+# that are compared are listed in $BENCH_METRICS.
+#
+# Prints one line per regression or missing record and a summary line,
+# and returns 1 if any metric regressed or, unless $BENCH_ALLOW_MISSING
+# is set, if a baseline record is missing from the results.
+compare_bench_results()
+{
+    local baseline="$1"
+    local results="$2"
+
+    awk -v tolerance="$BENCH_TOLERANCE" -v metrics="$BENCH_METRICS" \
+        -v higher_units="$BENCH_HIGHER_UNITS" \
+        -v allow_missing="$BENCH_ALLOW_MISSING" '
+        function parse(line, rec,    i, n, f, eq) {
+            delete rec
+            n = split(line, f, " ")
+            for (i = 1; i <= n; i++) {
+                eq = index(f[i], "=")
+                if (eq)
+                    rec[substr(f[i], 1, eq - 1)] = substr(f[i], eq + 1)
+            }
+        }
+        # tests may print several records with the same name
+        function record_id(rec, seen,    id) {
+            id = rec["test"] " " rec["name"]
+            return id "#" ++seen[id]
+        }
+        BEGIN {
+            nr_metrics = split(metrics, metric, " ")
+            n = split(higher_units, f, " ")
+            for (i = 1; i <= n; i++)
+                higher[f[i]] = 1
+        }
+        FNR == NR {
+            parse($0, rec)
+            id = record_id(rec, base_seen)
+            base[id] = 1
+            for (i = 1; i <= nr_metrics; i++) {
+                m = metric[i]
+                if (!(m in rec))
+                    continue
+                base_val[id, m] = rec[m]
+                tol[id, m] = tolerance
+                if ("tolerance" in rec)
+                    tol[id, m] = rec["tolerance"]
+                if (("tolerance." m) in rec)
+                    tol[id, m] = rec["tolerance." m]
+            }
+            next
+        }
+        {
+            parse($0, rec)
+            id = record_id(rec, cur_seen)
+            if (!(id in base))
+                next
+            found[id] = 1
+            for (i = 1; i <= nr_metrics; i++) {
+                m = metric[i]
+                if (!(m in rec) || !((id, m) in base_val))
+                    continue
+                compared++
+                old = base_val[id, m] + 0
+                new = rec[m] + 0
+                if (rec["unit"] in higher)
+                    worse = new < old * (1 - tol[id, m] / 100)
+                else
+                    worse = new > old * (1 + tol[id, m] / 100)
+                if (worse) {
+                    regressed++
+                    printf "REGRESSION %s %s %s: %s -> %s %s (%+d%%, tolerance %s%%)\n", \
+                           rec["test"], rec["name"], m, old, new, rec["unit"], \
+                           old ? (new - old) * 100 / old : 100, tol[id, m]
+                }
+            }
+        }
+        END {
+            for (id in base)
+                if (!(id in found)) {
+                    missing++
+                    split(id, f, "#")
+                    printf "MISSING %s\n", f[1]
+                }
+            printf "%d metrics compared, %d regressions, %d records missing\n", \
+                   compared, regressed, missing
+            exit (regressed || (missing && !allow_missing)) ? 1 : 0
+        }
+    ' "$baseline" "$results"
+}
+
+# Prints the extra_params $1 with the words $2 put in front of the
+# arguments of its -append option, adding one if there is none.
+prepend_append_args()
+{
+    local opts="$1"
+    local args="$2"
+    local quoted='^(.*)-append +"([^"]*)"(.*)$'
+    local bare='^(.*)-append +([^ "]+)(.*)$'
+
+    if [[ $opts =~ $quoted ]] || [[ $opts =~ $bare ]]; then
+        echo "${BASH_REMATCH[1]}-append \"$args ${BASH_REMATCH[2]}\"${BASH_REMATCH[3]}"
+    else
+        echo "$opts -append \"$args\""
+    fi
+}
+
+# Splits the tests of a unittests.cfg entry with shards = <num> into at
+# most that many groups of about the same duration.  The test kernel
+# prints the index and name of the tests it would run when given --list,
+# and runs only those in the hexadecimal bitmap HEX when given
+# --select=HEX (see x86/vmx.c).  The durations are taken from the
+# duration.<name> BENCH: records in $TEST_DURATIONS, by default the
+# BENCHMARKS file of the previous run; tests without one count as the
+# average.  The longest test goes to the least loaded group first.
+#
+# Takes the same arguments as run() and prints one bitmap per group.
+plan_shards()
+{
+    local testname="$1"
+    local smp="$3"
+    local kernel="$4"
+    local opts
+    local accel="${ACCEL:-$8}"
+    local timeout="${9:-$TIMEOUT}"
+    local shards="${10}"
+    local durations="${TEST_DURATIONS:-$unittest_log_dir.old/BENCHMARKS}"
+    local cr=$'\r'
+
+    [ -f "$durations" ] || durations=/dev/null
+    opts=$(prepend_append_args "$5" --list)
+
+    eval $(get_cmdline $kernel) 2>/dev/null |
+        sed -n "s/$cr\$//; s/^TEST: //p" |
+        awk -v test="$testname" -v shards="$shards" -v dfile="$durations" '
+            FILENAME == dfile {
+                test_name = ""; name = ""; mean = ""
+                for (i = 1; i <= NF; i++) {
+                    if ($i ~ /^test=/)
+                        test_name = substr($i, 6)
+                    else if ($i ~ /^name=duration\./)
+                        name = substr($i, 15)
+                    else if ($i ~ /^mean=/)
+                        mean = substr($i, 6)
+                }
+                sub(/\.shard[0-9]+$/, "", test_name)
+                if (test_name == test && name != "") {
+                    dur[name] = mean
+                    total += mean
+                    known++
+                }
+                next
+            }
+            { index_of[n] = $1; weight[n] = $2; n++ }
+            END {
+                if (!n)
+                    exit
+                if (shards > n)
+                    shards = n
+                for (i = 0; i < n; i++) {
+                    name = weight[i]
+                    weight[i] = name in dur ? dur[name] : known ? total / known : 1
+                    if (weight[i] < 1)
+                        weight[i] = 1
+                }
+                for (k = 0; k < n; k++) {
+                    t = -1
+                    for (i = 0; i < n; i++)
+                        if (!taken[i] && (t < 0 || weight[i] > weight[t]))
+                            t = i
+                    taken[t] = 1
+                    s = 0
+                    for (j = 1; j < shards; j++)
+                        if (load[j] < load[s])
+                            s = j
+                    load[s] += weight[t]
+                    d = int(index_of[t] / 4)
+                    bits[s, d] += 2 ^ (index_of[t] % 4)
+                    if (d >= digits)
+                        digits = d + 1
+                }
+                for (s = 0; s < shards; s++) {
+                    mask = ""
+                    for (d = 0; d < digits; d++)
+                        mask = mask sprintf("%x", bits[s, d])
+                    print mask
+                }
+            }' "$durations" -
+}
+
 #
 # Probe for MAX_SMP, in case it's less than the number of host cpus.
 #
@@ -1,11 +1,24 @@
-
+/*
+ * Page table access checks
+ *
+ * Every legal combination of the flags below is set up in the page tables
+ * and checked against the expected outcome.  flags=start:end restricts the
+ * run to the combinations from start up to, but not including, end, and
+ * shard=i/n to the i-th of every n legal combinations in that range.
+ * verbosity=N sets how many PASS lines are printed, see lib/report.c.
+ *
+ * Each run prints a checksum of the results next to the number of tests.
+ * The checksum is a sum, so the checksums of shards 0/n to n-1/n add up to
+ * the checksum of the whole range, to be compared with a known-good run.
+ */
 #include "libcflat.h"
 #include "desc.h"
 #include "processor.h"
 #include "asm/page.h"
 #include "x86/vm.h"
-
-#define smp_id() 0
+#include "smp.h"
+#include "apic.h"
+#include "smp_barrier.h"
 
 #define true 1
 #define false 0
@@ -15,9 +28,13 @@ static _Bool verbose = false;
 typedef unsigned long pt_element_t;
 static int invalid_mask;
 static int page_table_levels;
+static unsigned ac_flags_start;
+static unsigned ac_flags_end;
+static int shard;
+static int nr_shards = 1;
 
 #define PT_BASE_ADDR_MASK ((pt_element_t)((((pt_element_t)1 << 36) - 1) & PAGE_MASK))
-#define PT_PSE_BASE_ADDR_MASK (PT_BASE_ADDR_MASK & ~(1ull << 21))
+#define PT_PSE_BASE_ADDR_MASK (PT_BASE_ADDR_MASK & ~((1ull << 21) - 1))
 
 #define CR0_WP_MASK (1UL << 16)
 #define CR4_SMEP_MASK (1UL << 20)
@@ -35,6 +52,15 @@ static int page_table_levels;
 #define PT_INDEX(address, level)       \
        ((address) >> (12 + ((level)-1) * 9)) & 511
 
+/*
+ * Each CPU's test address has its own top-level page table entry, for 64
+ * CPUs they stay canonical and clear of those used by ac_test_cases.
+ */
+#define AC_MAX_CPUS 64
+
+/* 0x20 is the IPI vector that on_cpus() relies on. */
+#define AC_KERNEL_ENTRY_VECTOR 0x21
+
 /*
  * page table access check tests
  */
@@ -173,35 +199,67 @@ typedef struct {
 } __attribute__((packed)) descriptor_table_t;
 
 
+/*
+ * Each CPU runs its share of the tests with its own control register
+ * shadows, page table pool and user stack.
+ */
+typedef struct {
+    unsigned long shadow_cr0;
+    unsigned long shadow_cr4;
+    unsigned long long shadow_efer;
+    ac_pool_t pool;
+    unsigned unique;
+    int tests;
+    int successes;
+    u64 checksum;
+    unsigned char user_stack[4096] __attribute__((aligned(16)));
+} ac_cpu_t;
+
+static int nr_cpus;
+static int nr_active;
+static ac_cpu_t ac_cpus[AC_MAX_CPUS];
+static struct smp_barrier ac_barrier;
+static struct spinlock ac_print_lock;
+
 static void ac_test_show(ac_test_t *at);
 
-static unsigned long shadow_cr0;
-static unsigned long shadow_cr4;
-static unsigned long long shadow_efer;
+static ac_cpu_t *this_cpu(void)
+{
+    return &ac_cpus[smp_cpu_index()];
+}
+
+static void ac_read_shadows(ac_cpu_t *c)
+{
+    c->shadow_cr0 = read_cr0();
+    c->shadow_cr4 = read_cr4();
+    c->shadow_efer = rdmsr(MSR_EFER);
+}
 
 static void set_cr0_wp(int wp)
 {
-    unsigned long cr0 = shadow_cr0;
+    ac_cpu_t *c = this_cpu();
+    unsigned long cr0 = c->shadow_cr0;
 
     cr0 &= ~CR0_WP_MASK;
     if (wp)
 	cr0 |= CR0_WP_MASK;
-    if (cr0 != shadow_cr0) {
+    if (cr0 != c->shadow_cr0) {
         write_cr0(cr0);
-        shadow_cr0 = cr0;
+        c->shadow_cr0 = cr0;
     }
 }
 
 static unsigned set_cr4_smep(int smep)
 {
-    unsigned long cr4 = shadow_cr4;
+    ac_cpu_t *c = this_cpu();
+    unsigned long cr4 = c->shadow_cr4;
     extern u64 ptl2[];
     unsigned r;
 
     cr4 &= ~CR4_SMEP_MASK;
     if (smep)
 	cr4 |= CR4_SMEP_MASK;
-    if (cr4 == shadow_cr4)
+    if (cr4 == c->shadow_cr4)
         return 0;
 
     if (smep)
@@ -210,48 +268,77 @@ static unsigned set_cr4_smep(int smep)
     if (r || !smep)
         ptl2[2] |= PT_USER_MASK;
     if (!r)
-        shadow_cr4 = cr4;
+        c->shadow_cr4 = cr4;
     return r;
 }
 
+/*
+ * set_cr4_smep() makes the test code supervisor-only in the page tables
+ * that all CPUs share, so it may only become user-accessible again once
+ * every CPU has cleared CR4.SMEP.
+ */
+static void ac_leave_smep(int cpu)
+{
+    ac_cpu_t *c = &ac_cpus[cpu];
+    extern u64 ptl2[];
+
+    smp_barrier_wait(&ac_barrier, cpu);
+    if (c->shadow_cr4 & CR4_SMEP_MASK) {
+        c->shadow_cr4 &= ~CR4_SMEP_MASK;
+        write_cr4(c->shadow_cr4);
+    }
+    smp_barrier_wait(&ac_barrier, cpu);
+    ptl2[2] |= PT_USER_MASK;
+    write_cr3(read_cr3());
+}
+
 static void set_cr4_pke(int pke)
 {
-    unsigned long cr4 = shadow_cr4;
+    ac_cpu_t *c = this_cpu();
+    unsigned long cr4 = c->shadow_cr4;
 
     cr4 &= ~X86_CR4_PKE;
     if (pke)
 	cr4 |= X86_CR4_PKE;
-    if (cr4 == shadow_cr4)
+    if (cr4 == c->shadow_cr4)
         return;
 
     /* Check that protection keys do not affect accesses when CR4.PKE=0.  */
-    if ((shadow_cr4 & X86_CR4_PKE) && !pke)
+    if ((c->shadow_cr4 & X86_CR4_PKE) && !pke)
         write_pkru(0xfffffffc);
     write_cr4(cr4);
-    shadow_cr4 = cr4;
+    c->shadow_cr4 = cr4;
 }
 
 static void set_efer_nx(int nx)
 {
-    unsigned long long efer = shadow_efer;
+    ac_cpu_t *c = this_cpu();
+    unsigned long long efer = c->shadow_efer;
 
     efer &= ~EFER_NX_MASK;
     if (nx)
 	efer |= EFER_NX_MASK;
-    if (efer != shadow_efer) {
+    if (efer != c->shadow_efer) {
         wrmsr(MSR_EFER, efer);
-        shadow_efer = efer;
+        c->shadow_efer = efer;
     }
 }
 
-static void ac_env_int(ac_pool_t *pool)
+static void ac_env_int(void)
 {
     extern char page_fault, kernel_entry;
     set_idt_entry(14, &page_fault, 0);
-    set_idt_entry(0x20, &kernel_entry, 3);
+    set_idt_entry(AC_KERNEL_ENTRY_VECTOR, &kernel_entry, 3);
+}
 
-    pool->pt_pool = 33 * 1024 * 1024;
-    pool->pt_pool_size = 120 * 1024 * 1024 - pool->pt_pool;
+/* The active CPUs split the pool memory between them. */
+static void ac_pool_init(ac_pool_t *pool, int cpu)
+{
+    unsigned size = (120 * 1024 * 1024 - 33 * 1024 * 1024) / nr_active;
+
+    size &= PAGE_MASK;
+    pool->pt_pool = 33 * 1024 * 1024 + cpu * size;
+    pool->pt_pool_size = size;
     pool->pt_pool_current = 0;
 }
 
@@ -272,6 +359,16 @@ static int ac_test_bump_one(ac_test_t *at)
 
 #define F(x)  ((flags & x##_MASK) != 0)
 
+/* splitmix64 of the flags and the result of one test */
+static u64 ac_result_hash(unsigned flags, int pass)
+{
+    u64 x = (u64)flags << 1 | !!pass;
+
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
 static _Bool ac_test_legal(ac_test_t *at)
 {
     int flags = at->flags;
@@ -610,16 +707,18 @@ static void ac_test_check(ac_test_t *at, _Bool *success_ret, _Bool cond,
 
     *success_ret = false;
 
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    spin_lock(&ac_print_lock);
     if (!verbose) {
         puts("\n");
         ac_test_show(at);
     }
-
-    va_start(ap, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, ap);
-    va_end(ap);
     printf("FAIL: %s\n", buf);
     dump_mapping(at);
+    spin_unlock(&ac_print_lock);
 }
 
 static int pt_match(pt_element_t pte1, pt_element_t pte2, pt_element_t ignore)
@@ -631,22 +730,21 @@ static int pt_match(pt_element_t pte1, pt_element_t pte2, pt_element_t ignore)
 
 static int ac_test_do_access(ac_test_t *at)
 {
-    static unsigned unique = 42;
+    ac_cpu_t *c = this_cpu();
     int fault = 0;
     unsigned e;
-    static unsigned char user_stack[4096];
     unsigned long rsp;
     _Bool success = true;
     int flags = at->flags;
 
-    ++unique;
-    if (!(unique & 65535)) {
+    ++c->unique;
+    if (!(c->unique & 65535)) {
         puts(".");
     }
 
     *((unsigned char *)at->phys) = 0xc3; /* ret */
 
-    unsigned r = unique;
+    unsigned r = c->unique;
     set_cr0_wp(F(AC_CPU_CR0_WP));
     set_efer_nx(F(AC_CPU_EFER_NX));
     set_cr4_pke(F(AC_CPU_CR4_PKE));
@@ -702,8 +800,8 @@ static int ac_test_do_access(ac_test_t *at)
 		    [fetch]"r"(F(AC_ACCESS_FETCH)),
 		    [user_ds]"i"(USER_DS),
 		    [user_cs]"i"(USER_CS),
-		    [user_stack_top]"r"(user_stack + sizeof user_stack),
-		    [kernel_entry_vector]"i"(0x20)
+		    [user_stack_top]"r"(c->user_stack + sizeof c->user_stack),
+		    [kernel_entry_vector]"i"(AC_KERNEL_ENTRY_VECTOR)
 		  : "rsi");
 
     asm volatile (".section .text.pf \n\t"
@@ -743,9 +841,10 @@ static int ac_test_do_access(ac_test_t *at)
     return success;
 }
 
+/* Call with ac_print_lock held, line is too big for the AP stacks. */
 static void ac_test_show(ac_test_t *at)
 {
-    char line[5000];
+    static char line[5000];
 
     *line = 0;
     strcat(line, "test");
@@ -935,7 +1034,9 @@ static int ac_test_exec(ac_test_t *at, ac_pool_t *pool)
     int r;
 
     if (verbose) {
+        spin_lock(&ac_print_lock);
         ac_test_show(at);
+        spin_unlock(&ac_print_lock);
     }
     ac_test_setup_pte(at, pool);
     r = ac_test_do_access(at);
@@ -951,18 +1052,74 @@ const ac_test_fn ac_test_cases[] =
 	check_smep_andnot_wp
 };
 
-static int ac_test_run(void)
+/*
+ * Of the legal tests in the range that belong to this shard, CPU n runs the
+ * n-th of every nr_active.  Tests with CR4.SMEP
+ * set cannot overlap with user accesses on other CPUs, see set_cr4_smep(),
+ * so all CPUs wait for each other whenever the enumeration moves into or
+ * out of a range of CR4.SMEP tests.
+ */
+static void ac_test_shard(void *data)
 {
+    int cpu = smp_cpu_index();
+    ac_cpu_t *c = &ac_cpus[cpu];
+    unsigned long n = 0, k;
+    bool smep = false;
     ac_test_t at;
-    ac_pool_t pool;
-    int i, tests, successes;
+    int pass;
+
+    if (cpu >= nr_active)
+	return;
+
+    ac_read_shadows(c);
+    ac_pool_init(&c->pool, cpu);
+    c->unique = 42;
+    c->tests = c->successes = 0;
+    c->checksum = 0;
+
+    /*
+     * A 2M mapping of the test page also maps the other CPUs' test pages,
+     * so the address has the same offset in its 2M page as the test page.
+     */
+    ac_test_init(&at, (void *)(0x123400000000 + ((unsigned long)cpu << 39) +
+                               cpu * PAGE_SIZE));
+    at.phys += cpu * PAGE_SIZE;
+
+    do {
+	if (at.flags < ac_flags_start)
+	    continue;
+	if (at.flags >= ac_flags_end)
+	    break;
+	if (!!(at.flags & AC_CPU_CR4_SMEP_MASK) != smep) {
+	    if (smep)
+		ac_leave_smep(cpu);
+	    else
+		smp_barrier_wait(&ac_barrier, cpu);
+	    smep = !smep;
+	}
+	k = n++;
+	if (k % nr_shards != shard || k / nr_shards % nr_active != cpu)
+	    continue;
+	pass = ac_test_exec(&at, &c->pool);
+	++c->tests;
+	c->successes += pass;
+	c->checksum += ac_result_hash(at.flags, pass);
+    } while (ac_test_bump(&at));
+
+    if (smep)
+	ac_leave_smep(cpu);
+}
+
+static int ac_test_run(void)
+{
+    ac_cpu_t *c = this_cpu();
+    int i, cpu, tests, successes, range_tests = 0;
+    u64 checksum = 0;
 
     printf("run\n");
     tests = successes = 0;
 
-    shadow_cr0 = read_cr0();
-    shadow_cr4 = read_cr4();
-    shadow_efer = rdmsr(MSR_EFER);
+    ac_read_shadows(c);
 
     if (cpuid_maxphyaddr() >= 52) {
         invalid_mask |= AC_PDE_BIT51_MASK;
@@ -979,7 +1136,7 @@ static int ac_test_run(void)
         /* Now PKRU = 0xFFFFFFFF.  */
     } else {
 	tests++;
-	if (write_cr4_checking(shadow_cr4 | X86_CR4_PKE) == GP_VECTOR) {
+	if (write_cr4_checking(c->shadow_cr4 | X86_CR4_PKE) == GP_VECTOR) {
             successes++;
             invalid_mask |= AC_PKU_AD_MASK;
             invalid_mask |= AC_PKU_WD_MASK;
@@ -1004,16 +1161,24 @@ static int ac_test_run(void)
 	}
     }
 
-    ac_env_int(&pool);
-    ac_test_init(&at, (void *)(0x123400000000 + 16 * smp_id()));
-    do {
-	++tests;
-	successes += ac_test_exec(&at, &pool);
-    } while (ac_test_bump(&at));
-
-    for (i = 0; i < ARRAY_SIZE(ac_test_cases); i++) {
-	++tests;
-	successes += ac_test_cases[i](&pool);
+    ac_env_int();
+    on_cpus(ac_test_shard, NULL);
+    for (cpu = 0; cpu < nr_active; cpu++) {
+	range_tests += ac_cpus[cpu].tests;
+	successes += ac_cpus[cpu].successes;
+	checksum += ac_cpus[cpu].checksum;
+    }
+    tests += range_tests;
+    printf("\nflags %u:%u, shard %d/%d: %d tests, checksum %016" PRIx64 "\n",
+           ac_flags_start, ac_flags_end, shard, nr_shards, range_tests,
+           checksum);
+
+    /* The fixed cases run once, in shard 0 of the whole flag space. */
+    if (!shard && !ac_flags_start && ac_flags_end == 1u << NR_AC_FLAGS) {
+	for (i = 0; i < ARRAY_SIZE(ac_test_cases); i++) {
+	    ++tests;
+	    successes += ac_test_cases[i](&c->pool);
+	}
     }
 
     printf("\n%d tests, %d failures\n", tests, tests - successes);
@@ -1021,20 +1186,49 @@ static int ac_test_run(void)
     return successes == tests;
 }
 
-int main(void)
+static void ac_setup_5level(void *data)
 {
-    int r;
+    setup_5level_page_table();
+}
+
+int main(int ac, char **av)
+{
+    char *p;
+    int i, r;
+
+    ac_flags_end = 1u << NR_AC_FLAGS;
+    for (i = 1; i < ac; i++) {
+	if (!strncmp(av[i], "flags=", 6) && (p = strchr(av[i], ':'))) {
+	    ac_flags_start = atol(av[i] + 6);
+	    ac_flags_end = atol(p + 1);
+	} else if (!strncmp(av[i], "shard=", 6) && (p = strchr(av[i], '/'))) {
+	    shard = atol(av[i] + 6);
+	    nr_shards = atol(p + 1);
+	} else if (!strncmp(av[i], "verbosity=", 10)) {
+	    report_set_verbosity(atol(av[i] + 10));
+	} else {
+	    report_abort("unknown argument '%s'", av[i]);
+	}
+    }
+    if (ac_flags_start >= ac_flags_end || ac_flags_end > 1u << NR_AC_FLAGS)
+	report_abort("invalid flags=%u:%u", ac_flags_start, ac_flags_end);
+    if (nr_shards < 1 || shard < 0 || shard >= nr_shards)
+	report_abort("invalid shard=%d/%d", shard, nr_shards);
 
     setup_idt();
+    smp_init();
+    nr_cpus = cpu_count();
+    nr_active = MIN(nr_cpus, AC_MAX_CPUS);
+    smp_barrier_init(&ac_barrier, SMP_BARRIER_CENTRAL, nr_active);
 
-    printf("starting test\n\n");
+    printf("starting test on %d cpus\n\n", nr_active);
     page_table_levels = 4;
     r = ac_test_run();
 
     if (this_cpu_has(X86_FEATURE_LA57)) {
         page_table_levels = 5;
         printf("starting 5-level paging test.\n\n");
-        setup_5level_page_table();
+        on_cpus(ac_setup_5level, NULL);
         r = ac_test_run();
     }
 
@@ -0,0 +1,211 @@
+/*
+ * Page allocator and malloc SMP stress test
+ *
+ * Every participating CPU repeatedly allocates a batch of pages, tags
+ * them, checks the tags and frees the pages again.  The test is repeated
+ * with 1, 2, 4, ... CPUs, up to all of them, to show how alloc/free
+ * throughput scales with the number of vCPUs.  The same is then done
+ * with small malloc()s of 8 to 2048 bytes.  Finally the idle CPUs are
+ * made to zero free pages ahead of time.  Optional arguments are
+ * rounds=N and batch=N.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.
+ */
+#include "libcflat.h"
+#include "smp.h"
+#include "apic.h"
+#include "processor.h"
+#include "alloc.h"
+#include "alloc_page.h"
+#include "util.h"
+#include "bench.h"
+#include "smp_barrier.h"
+#include "asm/page.h"
+
+#define MAX_BATCH	512
+
+static int nr_cpus;
+static int nr_active;
+static long rounds = 1000;
+static long batch = 64;
+static bool use_malloc;
+static struct smp_barrier ready;
+static u64 cycles[MAX_TEST_CPUS];
+static volatile bool corrupted;
+static volatile bool oom;
+/* Too big for the 4K stacks of the APs */
+static void *pages[MAX_TEST_CPUS][MAX_BATCH];
+
+static void stress(void *data)
+{
+	int cpu = smp_cpu_index();
+	void **p = pages[cpu];
+	long i, r;
+	u64 t;
+
+	if (cpu >= nr_active)
+		return;
+
+	/* Start all CPUs at the same time. */
+	smp_barrier_wait(&ready, cpu);
+
+	t = rdtsc();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < batch; i++) {
+			if (use_malloc)
+				p[i] = malloc(8 << (i % 9));
+			else
+				p[i] = alloc_page();
+			if (!p[i]) {
+				oom = true;
+				break;
+			}
+			*(volatile long *)p[i] = cpu;
+		}
+		while (i--) {
+			if (*(volatile long *)p[i] != cpu)
+				corrupted = true;
+			if (use_malloc)
+				free(p[i]);
+			else
+				free_page(p[i]);
+		}
+	}
+	cycles[cpu] = rdtsc() - t;
+}
+
+static void run(int n)
+{
+	struct bench_stats stats;
+	u64 total = 0, wall = 0;
+	unsigned long pairs;
+	char name[32];
+	int cpu;
+
+	nr_active = n;
+	smp_barrier_init(&ready, SMP_BARRIER_DISSEMINATION, n);
+	on_cpus(stress, NULL);
+	smp_barrier_destroy(&ready);
+
+	for (cpu = 0; cpu < n; cpu++) {
+		total += cycles[cpu];
+		wall = MAX(wall, cycles[cpu]);
+	}
+
+	pairs = rounds * batch;
+	printf("%s, %d cpus: %" PRIu64 " cycles per alloc/free pair, "
+	       "%" PRIu64 " pairs per million cycles\n",
+	       use_malloc ? "malloc" : "alloc_page", n, total / (n * pairs),
+	       (u64)n * pairs * 1000000 / wall);
+
+	snprintf(name, sizeof(name), "%s_free_%dcpu",
+		 use_malloc ? "malloc" : "alloc", n);
+	bench_stats_mean(&stats, total, n * pairs);
+	bench_report(name, "cycles", &stats);
+}
+
+static bool page_is_zero(u64 *p)
+{
+	int i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(*p); i++)
+		if (p[i])
+			return false;
+	return true;
+}
+
+static void test_prezero(void)
+{
+	struct page_alloc_stats before, after;
+	void **p = pages[0];
+	bool zero = true;
+	int i;
+	u64 t;
+
+	if (nr_cpus < 2) {
+		report_skip("no idle CPU to zero pages");
+		return;
+	}
+
+	/* Give back dirty pages, the ones not cached by this CPU need zeroing. */
+	for (i = 0; i < MAX_BATCH; i++) {
+		p[i] = alloc_page();
+		memset(p[i], 0xaa, PAGE_SIZE);
+	}
+	for (i = 0; i < MAX_BATCH; i++)
+		free_page(p[i]);
+
+	page_alloc_get_stats(&before);
+	smp_idle_prezero(true);
+	t = rdtsc();
+	do {
+		pause();
+		page_alloc_get_stats(&after);
+	} while (after.zeroed_ahead == before.zeroed_ahead &&
+		 rdtsc() - t < (1ull << 32));
+	report(after.zeroed_ahead > before.zeroed_ahead,
+	       "idle CPUs zero free pages");
+
+	/* Help them finish, then stop them. */
+	while (page_alloc_prezero(64))
+		;
+	smp_idle_prezero(false);
+
+	page_alloc_get_stats(&before);
+	for (i = 0; i < MAX_BATCH; i++) {
+		p[i] = alloc_page();
+		zero &= page_is_zero(p[i]);
+	}
+	page_alloc_get_stats(&after);
+	for (i = 0; i < MAX_BATCH; i++)
+		free_page(p[i]);
+
+	report(zero, "allocated pages are zero");
+	report(after.prezeroed_used - before.prezeroed_used >= MAX_BATCH / 2,
+	       "allocations use pages zeroed ahead (%lu of %d)",
+	       after.prezeroed_used - before.prezeroed_used, MAX_BATCH);
+}
+
+int main(int ac, char **av)
+{
+	struct malloc_stats stats;
+	long val;
+	int i, n;
+
+	smp_init();
+	setup_vm();
+	nr_cpus = cpu_count();
+
+	for (i = 1; i < ac; i++) {
+		if (parse_keyval(av[i], &val) < 0)
+			report_abort("unknown argument '%s'", av[i]);
+		if (!strncmp(av[i], "rounds=", 7))
+			rounds = val;
+		else if (!strncmp(av[i], "batch=", 6))
+			batch = val;
+		else
+			report_abort("unknown option '%s'", av[i]);
+	}
+
+	if (batch < 1 || batch > MAX_BATCH || rounds < 1)
+		report_abort("invalid rounds=%ld batch=%ld", rounds, batch);
+
+	for (n = 1; n < nr_cpus; n *= 2)
+		run(n);
+	run(nr_cpus);
+
+	use_malloc = true;
+	for (n = 1; n < nr_cpus; n *= 2)
+		run(n);
+	run(nr_cpus);
+
+	malloc_get_stats(&stats);
+	printf("%lu small allocations (%lu bytes) served from %lu pages\n",
+	       stats.slab_allocs, stats.slab_bytes, stats.slab_pages);
+
+	report(!oom, "no allocation failures");
+	report(!corrupted, "pages are not shared between CPUs");
+
+	test_prezero();
+	return report_summary();
+}
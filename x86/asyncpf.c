@@ -98,6 +98,8 @@ int main(int ac, char **av)
 	wrmsr(MSR_KVM_ASYNC_PF_EN, virt_to_phys((void*)&apf_reason) |
 			KVM_ASYNC_PF_SEND_ALWAYS | KVM_ASYNC_PF_ENABLED);
 	printf("alloc memory\n");
+	/* the page fault handler remaps single 4k pages */
+	vm_set_huge_pages(false);
 	buf = malloc(MEM);
 	irq_enable();
 	while(loop--) {
@@ -0,0 +1,115 @@
+/*
+ * Test selection and per-test statistics shared by vmx.flat and svm.flat
+ *
+ * --list prints the index and name of every test table entry that the
+ * filters select, instead of running them.  --select=HEX only runs the
+ * entries whose index is set in HEX, hex digit n holding entries 4n to
+ * 4n + 3, lowest bit first.  run_tests.sh uses both to split the table
+ * into shards, see plan_shards in scripts/runtime.bash.
+ * --verbosity=N sets how many PASS lines are printed, see lib/report.c.
+ *
+ * Every test that runs reports its duration as a BENCH: record, which is
+ * what plan_shards balances the shards with, and its duration and L2 exits
+ * by exit reason as a record of the form
+ *
+ *   TEST_STATS: name=<name> cycles=<n> exits=<n> [exit.<reason>=<n> ...]
+ *
+ * which run_tests.sh collects in logs/TEST_STATS.
+ */
+#include "nested.h"
+#include "bench.h"
+
+bool nested_list_only;
+static const char *select_mask;
+
+static unsigned long exit_counts[NESTED_EXIT_SLOTS];
+static unsigned long nr_exits;
+
+/*
+ * Strips --list, --select=HEX and --verbosity=N from @argv, returns the
+ * new @argc.
+ */
+int nested_parse_args(int argc, const char *argv[])
+{
+	int i, n = 0;
+
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--list"))
+			nested_list_only = true;
+		else if (!strncmp(argv[i], "--select=", 9))
+			select_mask = argv[i] + 9;
+		else if (!strncmp(argv[i], "--verbosity=", 12))
+			report_set_verbosity(atol(argv[i] + 12));
+		else
+			argv[n++] = argv[i];
+	}
+	return n;
+}
+
+bool nested_test_selected(int index)
+{
+	char c;
+	int digit;
+
+	if (!select_mask)
+		return true;
+	if (index / 4 >= strlen(select_mask))
+		return false;
+	c = select_mask[index / 4];
+	digit = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+	return digit & (1 << (index % 4));
+}
+
+/* Names with spaces replaced by underscores, as test_wanted() matches them. */
+static void clean_test_name(char *buf, int size, const char *name)
+{
+	int i;
+
+	for (i = 0; i < size - 1 && name[i]; i++)
+		buf[i] = name[i] == ' ' ? '_' : name[i];
+	buf[i] = '\0';
+}
+
+void nested_list_test(int index, const char *name)
+{
+	char buf[64];
+
+	clean_test_name(buf, sizeof(buf), name);
+	printf("TEST: %d %s\n", index, buf);
+}
+
+void nested_reset_exits(void)
+{
+	memset(exit_counts, 0, sizeof(exit_counts));
+	nr_exits = 0;
+}
+
+/* Counts an exit from L2, @slot is the exit reason as the caller numbers it. */
+void nested_count_exit(unsigned int slot)
+{
+	nr_exits++;
+	if (slot < NESTED_EXIT_SLOTS)
+		exit_counts[slot]++;
+}
+
+void nested_report_test_stats(const char *name, u64 cycles,
+			      nested_slot_name_func slot_name)
+{
+	struct bench_stats stats;
+	char buf[80], reason[16];
+	int i;
+
+	strcpy(buf, "duration.");
+	clean_test_name(buf + 9, sizeof(buf) - 9, name);
+	bench_stats_mean(&stats, cycles, 1);
+	bench_report(buf, "cycles", &stats);
+
+	printf("TEST_STATS: name=%s cycles=%" PRIu64 " exits=%lu", buf + 9,
+	       cycles, nr_exits);
+	for (i = 0; i < NESTED_EXIT_SLOTS; i++)
+		if (exit_counts[i])
+			printf(" exit.%s=%lu",
+			       slot_name(i, reason, sizeof(reason)),
+			       exit_counts[i]);
+	printf("\n");
+}
@@ -0,0 +1,22 @@
+#ifndef __NESTED_H
+#define __NESTED_H
+
+#include "libcflat.h"
+
+/* Test selection and per-test statistics of vmx.flat and svm.flat */
+
+#define NESTED_EXIT_SLOTS	256
+
+typedef const char *(*nested_slot_name_func)(int slot, char *buf, int size);
+
+extern bool nested_list_only;
+
+int nested_parse_args(int argc, const char *argv[]);
+bool nested_test_selected(int index);
+void nested_list_test(int index, const char *name);
+void nested_reset_exits(void);
+void nested_count_exit(unsigned int slot);
+void nested_report_test_stats(const char *name, u64 cycles,
+			      nested_slot_name_func slot_name);
+
+#endif
@@ -20,11 +20,10 @@ int main (void)
     target_page = alloc_page();
 
     virt_addr = (void *) 0xfffffa000;
-    for (i = 0; i < nr_pages; i++) {
-        install_page(phys_to_virt(read_cr3()), virt_to_phys(target_page),
-                     virt_addr);
-        virt_addr += PAGE_SIZE;
-    }
+    install_pte_range(phys_to_virt(read_cr3()), 1, virt_addr,
+                      (size_t)nr_pages * PAGE_SIZE,
+                      virt_to_phys(target_page) | PT_PRESENT_MASK |
+                      PT_WRITABLE_MASK | PT_USER_MASK, 0);
     printf("created %d mappings\n", nr_pages);
 
     virt_addr = (void *) 0xfffffa000;
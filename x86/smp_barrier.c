@@ -0,0 +1,119 @@
+/*
+ * SMP barrier latency
+ *
+ * Checks that no CPU leaves a barrier before all have arrived, then
+ * measures how long a barrier episode takes with 1, 2, 4, ... CPUs, up
+ * to all of them, for every barrier kind in lib/smp_barrier.h.  The
+ * optional argument rounds=N sets the number of timed episodes.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.
+ */
+#include "libcflat.h"
+#include "smp.h"
+#include "apic.h"
+#include "processor.h"
+#include "alloc.h"
+#include "util.h"
+#include "smp_barrier.h"
+#include "bench.h"
+
+#define CHECK_ROUNDS	100
+
+static int nr_cpus;
+static int nr_active;
+static long rounds = 10000;
+static struct smp_barrier bar;
+static volatile long episode[MAX_TEST_CPUS];
+static volatile bool early;
+static u64 *samples;
+
+static void check(void *data)
+{
+	int cpu = smp_cpu_index();
+	long i;
+	int j;
+
+	if (cpu >= nr_active)
+		return;
+
+	for (i = 1; i <= CHECK_ROUNDS; i++) {
+		episode[cpu] = i;
+		smp_barrier_wait(&bar, cpu);
+		for (j = 0; j < nr_active; j++)
+			if (episode[j] < i)
+				early = true;
+		smp_barrier_wait(&bar, cpu);
+	}
+}
+
+static void bench(void *data)
+{
+	int cpu = smp_cpu_index();
+	long i;
+	u64 t;
+
+	if (cpu >= nr_active)
+		return;
+
+	smp_barrier_wait(&bar, cpu);
+	for (i = 0; i < rounds; i++) {
+		t = rdtsc();
+		smp_barrier_wait(&bar, cpu);
+		if (cpu == 0)
+			samples[i] = rdtsc() - t;
+	}
+}
+
+static void run(enum smp_barrier_type type, int n)
+{
+	struct bench_stats stats;
+	char name[48];
+
+	nr_active = n;
+	smp_barrier_init(&bar, type, n);
+	on_cpus(check, NULL);
+	on_cpus(bench, NULL);
+	smp_barrier_destroy(&bar);
+
+	bench_stats_compute(&stats, samples, rounds);
+	printf("%s barrier, %d cpus: %" PRIu64 " cycles median, %" PRIu64
+	       " cycles p99\n", smp_barrier_name(type), n, stats.p50, stats.p99);
+
+	snprintf(name, sizeof(name), "barrier_%s_%dcpu",
+		 smp_barrier_name(type), n);
+	bench_report(name, "cycles", &stats);
+}
+
+int main(int ac, char **av)
+{
+	enum smp_barrier_type type;
+	long val;
+	int i, n;
+
+	smp_init();
+	nr_cpus = cpu_count();
+
+	for (i = 1; i < ac; i++) {
+		if (parse_keyval(av[i], &val) < 0)
+			report_abort("unknown argument '%s'", av[i]);
+		if (!strncmp(av[i], "rounds=", 7))
+			rounds = val;
+		else
+			report_abort("unknown option '%s'", av[i]);
+	}
+
+	if (rounds < 1)
+		report_abort("invalid rounds=%ld", rounds);
+	samples = malloc(rounds * sizeof(*samples));
+	assert(samples);
+
+	for (type = SMP_BARRIER_CENTRAL; type <= SMP_BARRIER_DISSEMINATION;
+	     type++) {
+		for (n = 1; n < nr_cpus; n *= 2)
+			run(type, n);
+		run(type, nr_cpus);
+	}
+
+	report(!early, "no CPU leaves a barrier early");
+	return report_summary();
+}
@@ -1,7 +1,13 @@
 #include "libcflat.h"
 #include "smp.h"
+#include "apic.h"
+#include "work_queue.h"
+
+#define NR_JOBS 1000
 
 unsigned nipis;
+static unsigned next_job[MAX_TEST_CPUS];
+static volatile bool jobs_misplaced;
 
 static void ipi_test(void *data)
 {
@@ -14,10 +20,21 @@ static void ipi_test(void *data)
         nipis++;
 }
 
+static void job(void *data)
+{
+    long n = (long)data;
+
+    if (n / NR_JOBS != smp_id() || n % NR_JOBS != next_job[smp_id()])
+	jobs_misplaced = true;
+    next_job[smp_id()]++;
+}
+
 int main(void)
 {
+    struct completion done;
+    unsigned njobs = 0;
     int ncpus;
-    int i;
+    int i, j;
 
     smp_init();
 
@@ -27,5 +44,15 @@ int main(void)
 	on_cpu(i, ipi_test, (void *)(long)i);
 
     report(nipis == ncpus, "IPI to each CPU");
+
+    completion_init(&done);
+    for (j = 0; j < NR_JOBS; ++j)
+	for (i = 0; i < ncpus; ++i)
+	    queue_work(i, job, (void *)(long)(i * NR_JOBS + j), &done);
+    wait_for_completion(&done);
+    for (i = 0; i < ncpus; ++i)
+	njobs += next_job[i];
+    report(njobs == ncpus * NR_JOBS && !jobs_misplaced,
+	   "work queued on each CPU runs in order");
     return report_summary();
 }
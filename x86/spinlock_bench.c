@@ -0,0 +1,183 @@
+/*
+ * Spinlock throughput and fairness
+ *
+ * For every lock in asm-generic/spinlock-variants.h, and for the struct
+ * spinlock picked with configure --spinlock, 1, 2, 4, ... up to all CPUs
+ * take the lock in a loop until CPU 0 has taken it rounds=N times.
+ * hold=N and think=N set the number of pause instructions spent inside
+ * and outside the critical section, lock=NAME runs a single lock kind.
+ *
+ * For each run the test reports the cycles per acquisition over all
+ * CPUs, the distribution of CPU 0's wait for the lock, and the ratio of
+ * the fewest to the most acquisitions made by one CPU in permille.
+ * Under vCPU overcommit the difference between the kinds shows how well
+ * the host copes with lock holder and lock waiter preemption.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.
+ */
+#include "libcflat.h"
+#include "smp.h"
+#include "apic.h"
+#include "processor.h"
+#include "alloc.h"
+#include "util.h"
+#include "smp_barrier.h"
+#include "bench.h"
+
+static struct tas_lock tas;
+static struct ticket_lock ticket;
+static struct mcs_lock mcs;
+static struct spinlock spin;
+
+static void lock_tas(void) { tas_spin_lock(&tas); }
+static void unlock_tas(void) { tas_spin_unlock(&tas); }
+static void lock_ticket(void) { ticket_spin_lock(&ticket); }
+static void unlock_ticket(void) { ticket_spin_unlock(&ticket); }
+static void lock_mcs(void) { mcs_spin_lock(&mcs); }
+static void unlock_mcs(void) { mcs_spin_unlock(&mcs); }
+static void lock_spin(void) { spin_lock(&spin); }
+static void unlock_spin(void) { spin_unlock(&spin); }
+
+static const struct lock_kind {
+	const char *name;
+	void (*lock)(void);
+	void (*unlock)(void);
+} kinds[] = {
+	{ "tas", lock_tas, unlock_tas },
+	{ "ticket", lock_ticket, unlock_ticket },
+	{ "mcs", lock_mcs, unlock_mcs },
+	{ "spinlock", lock_spin, unlock_spin },
+};
+
+static int nr_cpus;
+static int nr_active;
+static long rounds = 100000;
+static long hold = 10;
+static long think = 10;
+static const struct lock_kind *kind;
+static struct smp_barrier start;
+static volatile bool stop;
+static volatile unsigned long counter;
+static unsigned long acquired[MAX_TEST_CPUS];
+static u64 wall;
+static u64 *samples;
+static bool lost;
+
+static void spin_for(long n)
+{
+	while (n--)
+		pause();
+}
+
+static void contend(void *data)
+{
+	int cpu = smp_cpu_index();
+	unsigned long n = 0;
+	u64 t0, t;
+
+	if (cpu >= nr_active)
+		return;
+
+	smp_barrier_wait(&start, cpu);
+	t0 = rdtsc();
+	while (!stop) {
+		t = rdtsc();
+		kind->lock();
+		if (cpu == 0)
+			samples[n] = rdtsc() - t;
+		counter++;
+		spin_for(hold);
+		kind->unlock();
+
+		if (++n == rounds && cpu == 0)
+			stop = true;
+		spin_for(think);
+	}
+	acquired[cpu] = n;
+	if (cpu == 0)
+		wall = rdtsc() - t0;
+}
+
+static void run(const struct lock_kind *k, int n)
+{
+	unsigned long total = 0, min = -1ul, max = 0;
+	struct bench_stats stats;
+	unsigned long fairness;
+	char name[48];
+	int cpu;
+
+	kind = k;
+	nr_active = n;
+	stop = false;
+	counter = 0;
+	smp_barrier_init(&start, SMP_BARRIER_CENTRAL, n);
+	on_cpus(contend, NULL);
+
+	for (cpu = 0; cpu < n; cpu++) {
+		total += acquired[cpu];
+		min = MIN(min, acquired[cpu]);
+		max = MAX(max, acquired[cpu]);
+	}
+	if (counter != total)
+		lost = true;
+	fairness = min * 1000 / max;
+
+	printf("%s, %d cpus: %" PRIu64 " cycles per acquisition, "
+	       "fairness %lu/1000\n", k->name, n, wall / total, fairness);
+
+	snprintf(name, sizeof(name), "lock_%s_%dcpu", k->name, n);
+	bench_stats_mean(&stats, wall, total);
+	bench_report(name, "cycles", &stats);
+
+	snprintf(name, sizeof(name), "lock_%s_%dcpu_wait", k->name, n);
+	bench_stats_compute(&stats, samples, rounds);
+	bench_report(name, "cycles", &stats);
+
+	snprintf(name, sizeof(name), "lock_%s_%dcpu_fairness", k->name, n);
+	bench_stats_mean(&stats, fairness * n, n);
+	bench_report(name, "permille", &stats);
+}
+
+int main(int ac, char **av)
+{
+	const char *only = NULL;
+	long val;
+	int i, n;
+
+	smp_init();
+	nr_cpus = cpu_count();
+
+	for (i = 1; i < ac; i++) {
+		if (!strncmp(av[i], "lock=", 5)) {
+			only = av[i] + 5;
+			continue;
+		}
+		if (parse_keyval(av[i], &val) < 0)
+			report_abort("unknown argument '%s'", av[i]);
+		if (!strncmp(av[i], "rounds=", 7))
+			rounds = val;
+		else if (!strncmp(av[i], "hold=", 5))
+			hold = val;
+		else if (!strncmp(av[i], "think=", 6))
+			think = val;
+		else
+			report_abort("unknown option '%s'", av[i]);
+	}
+
+	if (rounds < 1 || hold < 0 || think < 0)
+		report_abort("invalid rounds=%ld hold=%ld think=%ld",
+			     rounds, hold, think);
+	samples = malloc(rounds * sizeof(*samples));
+	assert(samples);
+
+	for (i = 0; i < ARRAY_SIZE(kinds); i++) {
+		if (only && strcmp(only, kinds[i].name))
+			continue;
+		for (n = 1; n < nr_cpus; n *= 2)
+			run(&kinds[i], n);
+		run(&kinds[i], nr_cpus);
+	}
+
+	report(!lost, "no lost updates under any lock");
+	return report_summary();
+}
@@ -13,6 +13,7 @@
 #include "alloc_page.h"
 #include "isr.h"
 #include "apic.h"
+#include "nested.h"
 
 /* for the nested page table*/
 u64 *pte[2048];
@@ -220,6 +221,27 @@ struct vmcb *vmcb;
 
 u64 guest_stack[10000];
 
+/*
+ * L2 exits of the current test, by exit code.  Of the codes above
+ * SVM_EXIT_MWAIT_COND only SVM_EXIT_NPF has a slot of its own.  Failed
+ * VMRUNs are not counted, as on VMX only entries that reached the guest
+ * are.
+ */
+#define EXIT_SLOT_NPF	(SVM_EXIT_MWAIT_COND + 1)
+#define EXIT_SLOT_OTHER	(SVM_EXIT_MWAIT_COND + 2)
+
+static void count_exit(u32 code)
+{
+	if (code == SVM_EXIT_ERR)
+		return;
+	if (code <= SVM_EXIT_MWAIT_COND)
+		nested_count_exit(code);
+	else if (code == SVM_EXIT_NPF)
+		nested_count_exit(EXIT_SLOT_NPF);
+	else
+		nested_count_exit(EXIT_SLOT_OTHER);
+}
+
 int svm_vmrun(void)
 {
 	vmcb->save.rip = (ulong)test_thunk;
@@ -232,6 +254,7 @@ int svm_vmrun(void)
 		: "a" (virt_to_phys(vmcb))
 		: "memory");
 
+	count_exit(vmcb->control.exit_code);
 	return (vmcb->control.exit_code);
 }
 
@@ -266,6 +289,7 @@ static void test_run(struct svm_test *test)
 			"r8", "r9", "r10", "r11" , "r12", "r13", "r14", "r15",
 			"memory");
 		++test->exits;
+		count_exit(vmcb->control.exit_code);
 	} while (!test->finished(test));
 	irq_enable();
 
@@ -332,7 +356,7 @@ static void setup_svm(void)
 int matched;
 
 static bool
-test_wanted(const char *name, char *filters[], int filter_count)
+test_wanted(const char *name, const char *filters[], int filter_count)
 {
         int i;
         bool positive = false;
@@ -367,12 +391,31 @@ test_wanted(const char *name, char *filters[], int filter_count)
         }
 }
 
-int main(int ac, char **av)
+static const char *exit_slot_name(int slot, char *buf, int size)
+{
+	if (slot == EXIT_SLOT_NPF)
+		return "npf";
+	if (slot == EXIT_SLOT_OTHER)
+		return "other";
+	snprintf(buf, size, "0x%x", slot);
+	return buf;
+}
+
+int main(int ac, const char *av[])
 {
 	int i = 0;
+	u64 t;
 
 	ac--;
 	av++;
+	ac = nested_parse_args(ac, av);
+
+	if (nested_list_only) {
+		for (; svm_tests[i].name != NULL; i++)
+			if (test_wanted(svm_tests[i].name, av, ac))
+				nested_list_test(i, svm_tests[i].name);
+		return 0;
+	}
 
 	setup_vm();
 	smp_init();
@@ -387,10 +430,12 @@ int main(int ac, char **av)
 	vmcb = alloc_page();
 
 	for (; svm_tests[i].name != NULL; i++) {
-		if (!test_wanted(svm_tests[i].name, av, ac))
+		if (!test_wanted(svm_tests[i].name, av, ac) || !nested_test_selected(i))
 			continue;
 		if (svm_tests[i].supported && !svm_tests[i].supported())
 			continue;
+		nested_reset_exits();
+		t = rdtsc();
 		if (svm_tests[i].v2 == NULL) {
 			test_run(&svm_tests[i]);
 		} else {
@@ -398,6 +443,8 @@ int main(int ac, char **av)
 			v2_test = &(svm_tests[i]);
 			svm_tests[i].v2();
 		}
+		nested_report_test_stats(svm_tests[i].name, rdtsc() - t,
+					 exit_slot_name);
 	}
 
 	if (!matched)
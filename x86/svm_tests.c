@@ -10,6 +10,7 @@
 #include "isr.h"
 #include "apic.h"
 #include "delay.h"
+#include "bench.h"
 
 #define SVM_EXIT_MAX_DR_INTERCEPT 0x3f
 
@@ -1020,6 +1021,170 @@ static bool lat_svm_insn_check(struct svm_test *test)
     return true;
 }
 
+/*
+ * Nested VM-exit round trips: for each exit below, L1 runs L2
+ * EXIT_BENCH_ROUNDS times and times each VMRUN until the exit is back in
+ * L1.  L2 only executes the intercepted instruction in a loop, the
+ * interrupt is already pending when VMRUN starts.
+ */
+#define EXIT_BENCH_ROUNDS 10000
+#define EXIT_BENCH_VECTOR 0xf1
+
+enum exit_bench_kind {
+    EXIT_BENCH_CPUID,
+    EXIT_BENCH_VMMCALL,
+    EXIT_BENCH_IO,
+    EXIT_BENCH_MSR,
+    EXIT_BENCH_NPF,
+    EXIT_BENCH_INTR,
+    EXIT_BENCH_DONE,
+};
+
+static const struct {
+    const char *name;
+    u32 exit_code;
+    int insn_len;
+} exit_bench_kinds[] = {
+    [EXIT_BENCH_CPUID]   = { "cpuid", SVM_EXIT_CPUID, 2 },
+    [EXIT_BENCH_VMMCALL] = { "vmmcall", SVM_EXIT_VMMCALL, 3 },
+    [EXIT_BENCH_IO]      = { "io", SVM_EXIT_IOIO, 2 },
+    [EXIT_BENCH_MSR]     = { "msr", SVM_EXIT_MSR, 2 },
+    [EXIT_BENCH_NPF]     = { "npf", SVM_EXIT_NPF, 2 },
+    [EXIT_BENCH_INTR]    = { "intr", SVM_EXIT_INTR, 0 },
+};
+
+static volatile enum exit_bench_kind exit_bench_kind;
+static u64 exit_bench_samples[EXIT_BENCH_ROUNDS];
+static int exit_bench_runs;
+static bool exit_bench_failed;
+
+static void exit_bench_isr(isr_regs_t *regs)
+{
+    apic_write(APIC_EOI, 0);
+}
+
+static void exit_bench_next(void)
+{
+    do
+        exit_bench_kind++;
+    while (exit_bench_kind == EXIT_BENCH_NPF && !npt_supported());
+    exit_bench_runs = 0;
+}
+
+static void exit_bench_prepare(struct svm_test *test)
+{
+    u64 *pte;
+
+    default_prepare(test);
+    handle_irq(EXIT_BENCH_VECTOR, exit_bench_isr);
+
+    vmcb->control.intercept |= (1ULL << INTERCEPT_CPUID) |
+                               (1ULL << INTERCEPT_IOIO_PROT) |
+                               (1ULL << INTERCEPT_MSR_PROT) |
+                               (1ULL << INTERCEPT_INTR);
+    vmcb->control.int_ctl |= V_INTR_MASKING_MASK;
+    io_bitmap[0x80 / 8] |= 1 << (0x80 % 8);
+    memset(msr_bitmap, 0xff, MSR_BITMAP_SIZE);
+
+    /* Not present in the NPT, every access is a nested page fault. */
+    if (npt_supported()) {
+        scratch_page = alloc_page();
+        pte = npt_get_pte((u64)scratch_page);
+        *pte &= ~1ULL;
+    } else {
+        report_skip("npf: NPT not supported");
+    }
+
+    exit_bench_kind = EXIT_BENCH_CPUID;
+    exit_bench_runs = 0;
+    exit_bench_failed = false;
+}
+
+static void exit_bench_prepare_gif_clear(struct svm_test *test)
+{
+    if (exit_bench_kind == EXIT_BENCH_INTR)
+        apic_icr_write(APIC_DEST_SELF | APIC_DEST_PHYSICAL |
+                       APIC_DM_FIXED | EXIT_BENCH_VECTOR, 0);
+    tsc_start = rdtsc();
+}
+
+static void exit_bench_test(struct svm_test *test)
+{
+    u64 rax;
+
+    while (exit_bench_kind != EXIT_BENCH_DONE) {
+        switch (exit_bench_kind) {
+        case EXIT_BENCH_CPUID:
+            raw_cpuid(0, 0);
+            break;
+        case EXIT_BENCH_VMMCALL:
+            vmmcall();
+            break;
+        case EXIT_BENCH_IO:
+            asm volatile ("inb $0x80, %%al" : : : "rax");
+            break;
+        case EXIT_BENCH_MSR:
+            rdmsr(MSR_EFER);
+            break;
+        case EXIT_BENCH_NPF:
+            rax = (u64)scratch_page;
+            asm volatile ("mov (%%rax), %%al" : "+a"(rax) : : "memory");
+            break;
+        default:
+            pause();
+            break;
+        }
+    }
+}
+
+static bool exit_bench_finished(struct svm_test *test)
+{
+    u64 cycles = rdtsc() - tsc_start;
+    enum exit_bench_kind kind = exit_bench_kind;
+    struct bench_stats stats;
+    char name[32];
+
+    /* The final VMMCALL of test_thunk */
+    if (kind == EXIT_BENCH_DONE)
+        return true;
+
+    if (vmcb->control.exit_code != exit_bench_kinds[kind].exit_code) {
+        report(false, "%s: unexpected exit 0x%x", exit_bench_kinds[kind].name,
+               vmcb->control.exit_code);
+        exit_bench_failed = true;
+        return true;
+    }
+
+    exit_bench_samples[exit_bench_runs++] = cycles;
+    vmcb->save.rip += exit_bench_kinds[kind].insn_len;
+    if (kind == EXIT_BENCH_INTR) {
+        irq_enable();
+        asm volatile ("nop");
+        irq_disable();
+    }
+
+    if (exit_bench_runs == EXIT_BENCH_ROUNDS) {
+        bench_stats_compute(&stats, exit_bench_samples, EXIT_BENCH_ROUNDS);
+        snprintf(name, sizeof(name), "svm_exit_%s", exit_bench_kinds[kind].name);
+        bench_report(name, "cycles", &stats);
+        printf("    %s: %" PRIu64 " cycles median, %" PRIu64 " cycles p99\n",
+               name, stats.p50, stats.p99);
+        exit_bench_next();
+    }
+
+    return false;
+}
+
+static bool exit_bench_check(struct svm_test *test)
+{
+    if (npt_supported())
+        *npt_get_pte((u64)scratch_page) |= 1ULL;
+    memset(msr_bitmap, 0, MSR_BITMAP_SIZE);
+    io_bitmap[0x80 / 8] &= ~(1 << (0x80 % 8));
+
+    return !exit_bench_failed && exit_bench_kind == EXIT_BENCH_DONE;
+}
+
 bool pending_event_ipi_fired;
 bool pending_event_guest_run;
 
@@ -1732,6 +1897,9 @@ struct svm_test svm_tests[] = {
     { "latency_svm_insn", default_supported, lat_svm_insn_prepare,
       default_prepare_gif_clear, null_test,
       lat_svm_insn_finished, lat_svm_insn_check },
+    { "exit_bench", default_supported, exit_bench_prepare,
+      exit_bench_prepare_gif_clear, exit_bench_test,
+      exit_bench_finished, exit_bench_check },
     { "exc_inject", default_supported, exc_inject_prepare,
       default_prepare_gif_clear, exc_inject_test,
       exc_inject_finished, exc_inject_check },
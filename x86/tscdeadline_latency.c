@@ -7,6 +7,8 @@
  * max(latency)
  * mean(latency)
  * hist(latency, 50)
+ *
+ * The distribution is also summarized in a BENCH: record, see lib/bench.h.
  */
 
 /*
@@ -27,6 +29,7 @@
 #include "desc.h"
 #include "isr.h"
 #include "msr.h"
+#include "bench.h"
 
 static void test_lapic_existence(void)
 {
@@ -103,6 +106,7 @@ static void test_tsc_deadline_timer(void)
 int main(int argc, char **argv)
 {
     int i, size;
+    struct bench_stats stats;
 
     setup_vm();
     smp_init();
@@ -128,5 +132,10 @@ int main(int argc, char **argv)
         printf("latency: %" PRId64 "\n", table[i]);
     }
 
+    if (table_idx) {
+        bench_stats_compute(&stats, table, table_idx);
+        bench_report("tscdeadline_latency", "cycles", &stats);
+    }
+
     return report_summary();
 }
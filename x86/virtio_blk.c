@@ -0,0 +1,283 @@
+/*
+ * virtio-blk IOPS and latency
+ *
+ * Drives the first virtio-blk device with 4K random and 1M sequential
+ * reads and writes, at queue depths 1, 4, 16 and 64, first with a
+ * single queue and then with 2, 4, ... queues up to as many as the
+ * device and the CPUs allow.  CPU n owns queue n and keeps qd requests
+ * in flight on it, queues are polled and only kicked once per batch
+ * of completions.
+ *
+ * For each run the test reports the IOPS over all queues and the
+ * distribution of the request latency from queueing to completion.
+ * ios=N sets the number of 4K requests per queue and run (1M runs do
+ * ios/32), qd=N runs a single queue depth.
+ *
+ * The device content is overwritten, back it with a scratch image.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+#include "libcflat.h"
+#include "smp.h"
+#include "apic.h"
+#include "processor.h"
+#include "vm.h"
+#include "alloc.h"
+#include "alloc_page.h"
+#include "asm/page.h"
+#include "delay.h"
+#include "util.h"
+#include "smp_barrier.h"
+#include "bench.h"
+#include "virtio.h"
+#include "virtio-blk.h"
+
+#define MAX_BS		(1 << 20)
+#define CHECK_REQS	16
+
+static const struct workload {
+	const char *name;
+	u32 type;
+	unsigned int bs;
+	bool random;
+} workloads[] = {
+	{ "randread_4k", VIRTIO_BLK_T_IN, 4096, true },
+	{ "randwrite_4k", VIRTIO_BLK_T_OUT, 4096, true },
+	{ "seqread_1m", VIRTIO_BLK_T_IN, 1 << 20, false },
+	{ "seqwrite_1m", VIRTIO_BLK_T_OUT, 1 << 20, false },
+};
+
+static const unsigned int depths[] = { 1, 4, 16, 64 };
+
+static struct virtio_blk blk;
+static int nr_cpus;
+static int nr_active;
+static long ios = 4096;
+static unsigned int max_qd;
+
+static const struct workload *wl;
+static unsigned int qd;
+static long nr_ios;
+static struct smp_barrier start;
+static u64 *samples;
+
+static struct cpu_state {
+	struct virtio_blk_req *reqs;
+	void *buf;
+	u64 rand;
+	u64 next;
+	u64 elapsed;
+	unsigned long errors;
+} state[MAX_TEST_CPUS];
+
+static u64 next_sector(struct cpu_state *s, int cpu)
+{
+	u64 blocks = blk.capacity * VIRTIO_BLK_SECTOR_SIZE / wl->bs;
+	u64 sectors = wl->bs / VIRTIO_BLK_SECTOR_SIZE;
+	u64 region, block;
+
+	if (wl->random) {
+		/* xorshift64 */
+		s->rand ^= s->rand << 13;
+		s->rand ^= s->rand >> 7;
+		s->rand ^= s->rand << 17;
+		return (s->rand % blocks) * sectors;
+	}
+
+	/* Every queue streams through its own slice of the disk. */
+	region = blocks / nr_active;
+	block = cpu * region + s->next++ % region;
+	return block * sectors;
+}
+
+static void submit(struct cpu_state *s, int cpu, struct virtio_blk_req *req)
+{
+	int ret;
+
+	req->start = rdtsc();
+	ret = virtio_blk_queue(&blk, cpu, req, wl->type, next_sector(s, cpu),
+			       s->buf, wl->bs);
+	assert(ret == 0);
+}
+
+static void worker(void *data)
+{
+	int cpu = smp_cpu_index();
+	struct cpu_state *s = &state[cpu];
+	struct virtio_blk_req *req;
+	long queued = 0, done = 0;
+	bool kick;
+	u64 t0;
+
+	if (cpu >= nr_active)
+		return;
+
+	s->next = 0;
+	smp_barrier_wait(&start, cpu);
+	t0 = rdtsc();
+
+	for (; queued < qd && queued < nr_ios; queued++)
+		submit(s, cpu, &s->reqs[queued]);
+	virtio_blk_kick(&blk, cpu);
+
+	while (done < nr_ios) {
+		kick = false;
+		while ((req = virtio_blk_get_req(&blk, cpu))) {
+			samples[cpu * nr_ios + done++] = rdtsc() - req->start;
+			if (req->status != VIRTIO_BLK_S_OK)
+				s->errors++;
+			if (queued < nr_ios) {
+				submit(s, cpu, req);
+				queued++;
+				kick = true;
+			}
+		}
+		if (kick)
+			virtio_blk_kick(&blk, cpu);
+		else
+			pause();
+	}
+
+	s->elapsed = rdtsc() - t0;
+}
+
+static void run(const struct workload *w, unsigned int depth, int n)
+{
+	struct bench_stats stats;
+	u64 wall = 0, iops;
+	char name[64];
+	int cpu;
+
+	wl = w;
+	qd = depth;
+	nr_active = n;
+	nr_ios = w->bs == 4096 ? ios : MAX(ios / 32, 1);
+	smp_barrier_init(&start, SMP_BARRIER_CENTRAL, n);
+	on_cpus(worker, NULL);
+
+	for (cpu = 0; cpu < n; cpu++)
+		wall = MAX(wall, state[cpu].elapsed);
+	iops = (u64)n * nr_ios * tsc_hz() / wall;
+	bench_stats_compute(&stats, samples, n * nr_ios);
+
+	printf("%s, qd %u, %d queues: %" PRIu64 " IOPS, %" PRIu64 " MB/s, "
+	       "%" PRIu64 " cycles median, %" PRIu64 " cycles p99\n",
+	       w->name, depth, n, iops, iops * w->bs >> 20,
+	       stats.p50, stats.p99);
+
+	snprintf(name, sizeof(name), "blk_%s_qd%u_%dq_lat", w->name, depth, n);
+	bench_report(name, "cycles", &stats);
+
+	snprintf(name, sizeof(name), "blk_%s_qd%u_%dq", w->name, depth, n);
+	bench_stats_mean(&stats, iops, 1);
+	bench_report(name, "iops", &stats);
+}
+
+/* Writes a pattern through queue 0 and reads it back. */
+static bool check_data(void)
+{
+	struct cpu_state *s = &state[0];
+	unsigned int nr = MIN(CHECK_REQS, max_qd);
+	u8 *out = s->buf, *in = s->buf + nr * 4096;
+	struct virtio_blk_req *req;
+	int i, n;
+
+	for (i = 0; i < nr * 4096; i++)
+		out[i] = i * 7 + i / 4096;
+	memset(in, 0, nr * 4096);
+
+	for (i = 0; i < nr; i++)
+		assert(!virtio_blk_queue(&blk, 0, &s->reqs[i], VIRTIO_BLK_T_OUT,
+					 i * 8, out + i * 4096, 4096));
+	virtio_blk_kick(&blk, 0);
+	for (n = 0; n < nr; n++) {
+		while (!(req = virtio_blk_get_req(&blk, 0)))
+			pause();
+		if (req->status != VIRTIO_BLK_S_OK)
+			return false;
+	}
+
+	for (i = 0; i < nr; i++)
+		assert(!virtio_blk_queue(&blk, 0, &s->reqs[i], VIRTIO_BLK_T_IN,
+					 i * 8, in + i * 4096, 4096));
+	virtio_blk_kick(&blk, 0);
+	for (n = 0; n < nr; n++) {
+		while (!(req = virtio_blk_get_req(&blk, 0)))
+			pause();
+		if (req->status != VIRTIO_BLK_S_OK)
+			return false;
+	}
+
+	return !memcmp(in, out, nr * 4096);
+}
+
+int main(int ac, char **av)
+{
+	unsigned int only_qd = 0;
+	unsigned long errors = 0;
+	long val;
+	int i, j, n, cpu, max_queues;
+
+	setup_vm();
+	smp_init();
+	nr_cpus = cpu_count();
+
+	for (i = 1; i < ac; i++) {
+		if (parse_keyval(av[i], &val) < 0)
+			report_abort("unknown argument '%s'", av[i]);
+		if (!strncmp(av[i], "ios=", 4))
+			ios = val;
+		else if (!strncmp(av[i], "qd=", 3))
+			only_qd = val;
+		else
+			report_abort("unknown option '%s'", av[i]);
+	}
+	if (ios < 1)
+		report_abort("invalid ios=%ld", ios);
+
+	if (!virtio_blk_init(&blk, (1ull << VIRTIO_RING_F_EVENT_IDX) |
+				   (1ull << VIRTIO_F_RING_PACKED))) {
+		report_skip("no virtio-blk device");
+		return report_summary();
+	}
+
+	max_queues = MIN(nr_cpus, (int)blk.nr_queues);
+	/* header, data and status take one descriptor each */
+	max_qd = blk.vqs[0]->num_free / 3;
+	printf("%" PRIu64 " sectors, %d queues used, %s ring, "
+	       "up to %u requests per queue\n", blk.capacity, max_queues,
+	       virtio_has_feature(blk.vdev, VIRTIO_F_RING_PACKED) ?
+	       "packed" : "split", max_qd);
+
+	if (only_qd > max_qd)
+		report_abort("qd=%u is more than the queue holds", only_qd);
+	if (blk.capacity * VIRTIO_BLK_SECTOR_SIZE < (u64)max_queues * MAX_BS)
+		report_abort("disk too small for %d queues", max_queues);
+
+	for (cpu = 0; cpu < max_queues; cpu++) {
+		state[cpu].reqs = virtio_blk_alloc_reqs(max_qd);
+		state[cpu].buf = alloc_pages(get_order(MAX_BS >> PAGE_SHIFT));
+		state[cpu].rand = cpu + 1;
+		assert(state[cpu].reqs && state[cpu].buf);
+	}
+	samples = malloc(max_queues * ios * sizeof(*samples));
+	assert(samples);
+
+	report(check_data(), "data read back matches data written");
+
+	for (i = 0; i < ARRAY_SIZE(workloads); i++) {
+		for (j = 0; j < ARRAY_SIZE(depths); j++) {
+			if (only_qd ? depths[j] != only_qd : depths[j] > max_qd)
+				continue;
+			for (n = 1; n < max_queues; n *= 2)
+				run(&workloads[i], depths[j], n);
+			run(&workloads[i], depths[j], max_queues);
+		}
+	}
+
+	for (cpu = 0; cpu < max_queues; cpu++)
+		errors += state[cpu].errors;
+	report(!errors, "all requests completed with VIRTIO_BLK_S_OK");
+
+	return report_summary();
+}
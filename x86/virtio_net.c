@@ -0,0 +1,265 @@
+/*
+ * virtio-net packet rate
+ *
+ * virtio-net devices are paired in PCI order, the first of each pair
+ * sends and the second receives, so each pair needs a local link such
+ * as two ports of a QEMU hub.  CPU n drives pair n: it keeps up to a
+ * receive ring worth of minimum size frames in flight, queueing batch
+ * frames per transmit kick and refilling the receive ring as frames
+ * arrive.
+ *
+ * After checking that a frame arrives unchanged, the test measures
+ * batch sizes 1, 8, 32 and 128 with 1, 2, 4, ... pairs up to all of
+ * them, and reports the packet rate over all pairs and the CPU cycles
+ * spent per packet.  packets=N sets the number of frames per pair and
+ * run, batch=N runs a single batch size.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+#include "libcflat.h"
+#include "smp.h"
+#include "apic.h"
+#include "processor.h"
+#include "vm.h"
+#include "alloc.h"
+#include "alloc_page.h"
+#include "asm/page.h"
+#include "delay.h"
+#include "util.h"
+#include "smp_barrier.h"
+#include "bench.h"
+#include "virtio.h"
+#include "virtio-net.h"
+
+#define MAX_PAIRS	8
+#define RX_BUF_SIZE	2048
+#define ETH_P_LOCAL	0x88b5
+
+static const unsigned int batches[] = { 1, 8, 32, 128 };
+
+static struct virtio_net nics[2 * MAX_PAIRS];
+static int nr_cpus;
+static int nr_active;
+static long packets = 100000;
+static unsigned int batch;
+static struct smp_barrier start;
+
+static struct pair {
+	struct virtio_net *tx;
+	struct virtio_net *rx;
+	u8 *frame;
+	unsigned int window;
+	u64 elapsed;
+	unsigned long received;
+	unsigned long lost;
+	unsigned long bad;
+} pairs[MAX_PAIRS];
+
+static unsigned int frame_size(struct pair *p)
+{
+	return p->tx->hdr_len + ETH_ZLEN;
+}
+
+static void init_pair(struct pair *p, struct virtio_net *tx,
+		      struct virtio_net *rx)
+{
+	u8 *eth, *rx_bufs;
+	unsigned int i;
+
+	p->tx = tx;
+	p->rx = rx;
+
+	p->frame = alloc_page();
+	assert(p->frame);
+	eth = p->frame + tx->hdr_len;
+	memcpy(eth, rx->mac, ETH_ALEN);
+	memcpy(eth + ETH_ALEN, tx->mac, ETH_ALEN);
+	eth[12] = ETH_P_LOCAL >> 8;
+	eth[13] = ETH_P_LOCAL & 0xff;
+	for (i = ETH_HLEN; i < ETH_ZLEN; i++)
+		eth[i] = i;
+
+	/* Fill the receive ring, it bounds the frames in flight. */
+	p->window = rx->rx->num_free;
+	rx_bufs = alloc_pages(get_order(p->window * RX_BUF_SIZE >> PAGE_SHIFT));
+	assert(rx_bufs);
+	for (i = 0; i < p->window; i++)
+		assert(!virtio_net_add_rx(rx, rx_bufs + i * RX_BUF_SIZE,
+					  RX_BUF_SIZE));
+	virtqueue_kick(rx->rx);
+}
+
+static void worker(void *data)
+{
+	int cpu = smp_cpu_index();
+	struct pair *p = &pairs[cpu];
+	unsigned long sent = 0, received = 0;
+	unsigned int n, len;
+	u64 t0, last, timeout = tsc_hz();
+	void *buf;
+
+	if (cpu >= nr_active)
+		return;
+
+	smp_barrier_wait(&start, cpu);
+	t0 = last = rdtsc();
+
+	while (received < packets) {
+		for (n = 0; n < batch && sent < packets &&
+			    sent - received < p->window; n++, sent++)
+			if (virtio_net_add_tx(p->tx, p->frame, frame_size(p)) < 0)
+				break;
+		if (n)
+			virtqueue_kick(p->tx->tx);
+
+		while (virtio_net_get_tx(p->tx))
+			;
+
+		n = 0;
+		while ((buf = virtio_net_get_rx(p->rx, &len))) {
+			if (len != ETH_ZLEN)
+				p->bad++;
+			assert(!virtio_net_add_rx(p->rx, buf, RX_BUF_SIZE));
+			received++;
+			n++;
+		}
+		if (n) {
+			virtqueue_kick(p->rx->rx);
+			last = rdtsc();
+		} else if (rdtsc() - last > timeout) {
+			/* Nothing for a second, the rest is not coming. */
+			p->lost += sent - received;
+			break;
+		}
+	}
+
+	p->elapsed = rdtsc() - t0;
+	p->received = received;
+}
+
+static void run(int n)
+{
+	u64 wall = 0, cycles = 0, pps;
+	unsigned long received = 0;
+	struct bench_stats stats;
+	char name[48];
+	int i;
+
+	nr_active = n;
+	smp_barrier_init(&start, SMP_BARRIER_CENTRAL, n);
+	on_cpus(worker, NULL);
+
+	for (i = 0; i < n; i++) {
+		wall = MAX(wall, pairs[i].elapsed);
+		cycles += pairs[i].elapsed;
+		received += pairs[i].received;
+	}
+	if (!received) {
+		printf("batch %u, %d pairs: no frames received\n", batch, n);
+		return;
+	}
+	pps = received * tsc_hz() / wall;
+
+	printf("batch %u, %d pairs: %" PRIu64 ".%03" PRIu64 " Mpps, %" PRIu64
+	       " cycles per packet\n", batch, n, pps / 1000000,
+	       pps / 1000 % 1000, cycles / received);
+
+	snprintf(name, sizeof(name), "net_batch%u_%dpair", batch, n);
+	bench_stats_mean(&stats, pps, 1);
+	bench_report(name, "pps", &stats);
+
+	snprintf(name, sizeof(name), "net_batch%u_%dpair_cycles", batch, n);
+	bench_stats_mean(&stats, cycles, received);
+	bench_report(name, "cycles", &stats);
+}
+
+/* Sends one frame over the first pair and compares what arrives. */
+static bool check_frame(void)
+{
+	struct pair *p = &pairs[0];
+	unsigned int len;
+	u64 t0;
+	u8 *buf;
+
+	assert(!virtio_net_add_tx(p->tx, p->frame, frame_size(p)));
+	virtqueue_kick(p->tx->tx);
+
+	t0 = rdtsc();
+	while (!(buf = virtio_net_get_rx(p->rx, &len))) {
+		if (rdtsc() - t0 > tsc_hz())
+			return false;
+		pause();
+	}
+	while (!virtio_net_get_tx(p->tx))
+		pause();
+
+	assert(!virtio_net_add_rx(p->rx, buf, RX_BUF_SIZE));
+	virtqueue_kick(p->rx->rx);
+
+	return len == ETH_ZLEN && !memcmp(buf + p->rx->hdr_len,
+					  p->frame + p->tx->hdr_len, len);
+}
+
+int main(int ac, char **av)
+{
+	unsigned int only_batch = 0;
+	unsigned long lost = 0, bad = 0;
+	int i, n, nr_nics, nr_pairs;
+	long val;
+
+	setup_vm();
+	smp_init();
+	nr_cpus = cpu_count();
+
+	for (i = 1; i < ac; i++) {
+		if (parse_keyval(av[i], &val) < 0)
+			report_abort("unknown argument '%s'", av[i]);
+		if (!strncmp(av[i], "packets=", 8))
+			packets = val;
+		else if (!strncmp(av[i], "batch=", 6))
+			only_batch = val;
+		else
+			report_abort("unknown option '%s'", av[i]);
+	}
+	if (packets < 1)
+		report_abort("invalid packets=%ld", packets);
+
+	for (nr_nics = 0; nr_nics < ARRAY_SIZE(nics); nr_nics++)
+		if (!virtio_net_init(&nics[nr_nics],
+				     (1ull << VIRTIO_RING_F_EVENT_IDX) |
+				     (1ull << VIRTIO_F_RING_PACKED)))
+			break;
+
+	nr_pairs = MIN(nr_nics / 2, nr_cpus);
+	if (!nr_pairs) {
+		report_skip("need two linked virtio-net devices");
+		return report_summary();
+	}
+	printf("%d pairs, %s ring\n", nr_pairs,
+	       virtio_has_feature(nics[0].vdev, VIRTIO_F_RING_PACKED) ?
+	       "packed" : "split");
+
+	for (i = 0; i < nr_pairs; i++)
+		init_pair(&pairs[i], &nics[2 * i], &nics[2 * i + 1]);
+	tsc_hz();
+
+	report(check_frame(), "frame received unchanged");
+
+	for (i = 0; i < ARRAY_SIZE(batches); i++) {
+		batch = only_batch ? only_batch : batches[i];
+		for (n = 1; n < nr_pairs; n *= 2)
+			run(n);
+		run(nr_pairs);
+		if (only_batch)
+			break;
+	}
+
+	for (i = 0; i < nr_pairs; i++) {
+		lost += pairs[i].lost;
+		bad += pairs[i].bad;
+	}
+	report(!lost, "no frames lost");
+	report(!bad, "all frames received with the length sent");
+
+	return report_summary();
+}
@@ -8,6 +8,9 @@
 #include "x86/acpi.h"
 #include "x86/apic.h"
 #include "x86/isr.h"
+#include "alloc.h"
+#include "util.h"
+#include "bench.h"
 
 #define IPI_TEST_VECTOR	0xb0
 
@@ -500,6 +503,23 @@ static struct test tests[] = {
 
 unsigned iterations;
 
+/*
+ * Statistical mode, enabled with iterations=N on the command line.
+ * Instead of doubling the iteration count until GOAL cycles have passed
+ * and printing the mean, each of the N iterations is timed on its own and
+ * the delta is stored in a per-CPU ring of ring=N entries (the most recent
+ * deltas win if the ring is smaller than the iteration count).  The first
+ * warmup=N iterations are executed but not recorded.
+ */
+#define DEFAULT_RING_SIZE	(1u << 16)
+#define DEFAULT_WARMUP		1000
+#define NR_HIST_BUCKETS		64
+
+static unsigned long stat_iterations;
+static unsigned long stat_warmup = DEFAULT_WARMUP;
+static unsigned long ring_size = DEFAULT_RING_SIZE;
+static u64 *sample_ring;
+
 static void run_test(void *_func)
 {
     int i;
@@ -509,10 +529,66 @@ static void run_test(void *_func)
         func();
 }
 
+static void run_test_sampled(void *_func)
+{
+	void (*func)(void) = _func;
+	u64 *ring = sample_ring + smp_cpu_index() * ring_size;
+	unsigned long i;
+	u64 t;
+
+	for (i = 0; i < stat_warmup; ++i)
+		func();
+
+	/* Only the serial tests use these, so parallel runs don't race. */
+	tsc_eoi = tsc_ipi = 0;
+	for (i = 0; i < stat_iterations; ++i) {
+		t = rdtsc();
+		func();
+		ring[i % ring_size] = rdtsc() - t;
+	}
+}
+
+static void print_stats(struct test *test, unsigned long nr_cpus_run)
+{
+	unsigned long hist[NR_HIST_BUCKETS] = { 0 };
+	unsigned long n, per_cpu, cpu, i;
+	struct bench_stats stats;
+	u64 *v = sample_ring;
+	int b;
+
+	per_cpu = MIN(stat_iterations, ring_size);
+
+	/* Compact the per-CPU rings into one contiguous array. */
+	for (cpu = 1; cpu < nr_cpus_run; ++cpu)
+		memmove(v + cpu * per_cpu, v + cpu * ring_size,
+			per_cpu * sizeof(*v));
+	n = per_cpu * nr_cpus_run;
+
+	bench_stats_compute(&stats, v, n);
+	for (i = 0; i < n; ++i) {
+		b = v[i] ? 64 - __builtin_clzll(v[i]) : 0;
+		hist[MIN(b, NR_HIST_BUCKETS - 1)]++;
+	}
+
+	printf("%s min %" PRIu64 " p50 %" PRIu64 " p90 %" PRIu64
+	       " p99 %" PRIu64 " p99.9 %" PRIu64 " max %" PRIu64
+	       " (%lu samples)\n", test->name, stats.min, stats.p50,
+	       stats.p90, stats.p99, stats.p999, stats.max, n);
+	bench_report(test->name, "cycles", &stats);
+
+	for (b = 0; b < NR_HIST_BUCKETS; ++b) {
+		if (!hist[b])
+			continue;
+		printf("  hist %s [%" PRIu64 ", %" PRIu64 ") %lu\n", test->name,
+		       b ? (u64)1 << (b - 1) : 0, (u64)1 << b, hist[b]);
+	}
+}
+
 static bool do_test(struct test *test)
 {
 	int i;
 	unsigned long long t1, t2;
+	struct bench_stats stats;
         void (*func)(void);
 
         iterations = 32;
@@ -532,6 +608,18 @@ static bool do_test(struct test *test)
 		return false;
 	}
 
+	if (stat_iterations) {
+		iterations = stat_iterations;
+
+		if (!test->parallel)
+			run_test_sampled(func);
+		else
+			on_cpus(run_test_sampled, func);
+
+		print_stats(test, test->parallel ? nr_cpus : 1);
+		goto out;
+	}
+
 	do {
 		tsc_eoi = tsc_ipi = 0;
 		iterations *= 2;
@@ -546,6 +634,9 @@ static bool do_test(struct test *test)
 		t2 = rdtsc();
 	} while ((t2 - t1) < GOAL);
 	printf("%s %d\n", test->name, (int)((t2 - t1) / iterations));
+	bench_stats_mean(&stats, t2 - t1, iterations);
+	bench_report(test->name, "cycles", &stats);
+out:
 	if (tsc_ipi)
 		printf("  ipi %s %d\n", test->name, (int)(tsc_ipi / iterations));
 	if (tsc_eoi)
@@ -574,18 +665,56 @@ static bool test_wanted(struct test *test, char *wanted[], int nwanted)
 	return false;
 }
 
+/*
+ * Options are given as key=value and are removed from the argument
+ * list, what is left are the names of the tests to run.
+ */
+static int parse_options(int ac, char **av)
+{
+	int i, nwanted = 0;
+	long val;
+
+	for (i = 0; i < ac; ++i) {
+		if (parse_keyval(av[i], &val) < 0) {
+			av[nwanted++] = av[i];
+			continue;
+		}
+
+		if (!strncmp(av[i], "iterations=", 11))
+			stat_iterations = val;
+		else if (!strncmp(av[i], "warmup=", 7))
+			stat_warmup = val;
+		else if (!strncmp(av[i], "ring=", 5))
+			ring_size = val;
+		else
+			report_abort("unknown option '%s'", av[i]);
+	}
+
+	if (stat_iterations && !ring_size)
+		report_abort("ring size must be non-zero");
+
+	return nwanted;
+}
+
 int main(int ac, char **av)
 {
 	int i;
 	unsigned long membar = 0;
 	struct pci_dev pcidev;
 	int ret;
+	int nwanted;
 
 	smp_init();
 	setup_vm();
 	handle_irq(IPI_TEST_VECTOR, self_ipi_isr);
 	nr_cpus = cpu_count();
 
+	nwanted = parse_options(ac - 1, av + 1);
+	if (stat_iterations) {
+		sample_ring = malloc(nr_cpus * ring_size * sizeof(*sample_ring));
+		assert(sample_ring);
+	}
+
 	irq_enable();
 	on_cpus(enable_nx, NULL);
 
@@ -602,7 +731,7 @@ int main(int ac, char **av)
 	}
 
 	for (i = 0; i < ARRAY_SIZE(tests); ++i)
-		if (test_wanted(&tests[i], av + 1, ac - 1))
+		if (test_wanted(&tests[i], av + 1, nwanted))
 			while (do_test(&tests[i])) {}
 
 	return 0;
@@ -38,6 +38,7 @@
 #include "msr.h"
 #include "smp.h"
 #include "apic.h"
+#include "nested.h"
 
 u64 *bsp_vmxon_region;
 struct vmcs *vmcs_root;
@@ -1805,6 +1806,9 @@ static void vmx_enter_guest(struct vmentry_result *result)
 						     vmcs_read(EXI_REASON);
 	result->entered = !result->vm_fail &&
 			  !result->exit_reason.failed_vmentry;
+
+	if (result->entered)
+		nested_count_exit(result->exit_reason.basic);
 }
 
 static int vmx_run(void)
@@ -2072,9 +2076,15 @@ test_wanted(const char *name, const char *filters[], int filter_count)
 	}
 }
 
+static const char *exit_slot_name(int slot, char *buf, int size)
+{
+	return exit_reason_description(slot);
+}
+
 int main(int argc, const char *argv[])
 {
 	int i = 0;
+	u64 t;
 
 	setup_vm();
 	smp_init();
@@ -2085,6 +2095,14 @@ int main(int argc, const char *argv[])
 
 	argv++;
 	argc--;
+	argc = nested_parse_args(argc, argv);
+
+	if (nested_list_only) {
+		for (; vmx_tests[i].name != NULL; i++)
+			if (test_wanted(vmx_tests[i].name, argv, argc))
+				nested_list_test(i, vmx_tests[i].name);
+		return 0;
+	}
 
 	if (!this_cpu_has(X86_FEATURE_VMX)) {
 		printf("WARNING: vmx not supported, add '-cpu host'\n");
@@ -2133,10 +2151,15 @@ int main(int argc, const char *argv[])
 	vmx_off();
 
 	for (; vmx_tests[i].name != NULL; i++) {
-		if (!test_wanted(vmx_tests[i].name, argv, argc))
+		if (!test_wanted(vmx_tests[i].name, argv, argc) ||
+		    !nested_test_selected(i))
 			continue;
+		nested_reset_exits();
+		t = rdtsc();
 		if (test_run(&vmx_tests[i]))
 			goto exit;
+		nested_report_test_stats(vmx_tests[i].name, rdtsc() - t,
+					 exit_slot_name);
 	}
 
 	if (!matched)
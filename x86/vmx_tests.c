@@ -20,6 +20,7 @@
 #include "alloc_page.h"
 #include "smp.h"
 #include "delay.h"
+#include "bench.h"
 
 #define NONCANONICAL            0xaaaaaaaaaaaaaaaaull
 
@@ -9789,6 +9790,210 @@ static void atomic_switch_overflow_msrs_test(void)
 		test_skip("Test is only supported on KVM");
 }
 
+/*
+ * Nested VM-exit round trips
+ *
+ * For each exit reason below, L1 enters L2 EXIT_BENCH_ROUNDS times and
+ * times each VM entry until the exit is back in L1, i.e. L0 emulating
+ * VMRESUME, L2 running into the exit, L0 reflecting it to L1 and L1
+ * reading the exit reason.  L2 does nothing but execute the exiting
+ * instruction in a loop, the preemption timer and external interrupt
+ * exits happen before L2 runs any instruction.  EPT is enabled when
+ * available, as it is in most nested guests.
+ *
+ * All exits are then measured again with VMCS shadowing enabled, which
+ * makes L0 keep the shadow VMCS up to date on every nested entry and
+ * exit.  Whether L0 itself shadows L1's VMCS is up to L0, compare runs
+ * with it on and off through the BENCH: records.
+ */
+#define EXIT_BENCH_ROUNDS	10000
+#define EXIT_BENCH_VECTOR	0xf1
+
+enum exit_bench_kind {
+	EXIT_BENCH_CPUID,
+	EXIT_BENCH_VMCALL,
+	EXIT_BENCH_IO,
+	EXIT_BENCH_MSR,
+	EXIT_BENCH_EPT,
+	EXIT_BENCH_PREEMPT,
+	EXIT_BENCH_EXTINT,
+	EXIT_BENCH_DONE,
+};
+
+static const struct {
+	const char *name;
+	u32 reason;
+} exit_bench_kinds[] = {
+	[EXIT_BENCH_CPUID]	= { "cpuid", VMX_CPUID },
+	[EXIT_BENCH_VMCALL]	= { "vmcall", VMX_VMCALL },
+	[EXIT_BENCH_IO]		= { "io", VMX_IO },
+	[EXIT_BENCH_MSR]	= { "msr", VMX_RDMSR },
+	[EXIT_BENCH_EPT]	= { "ept_violation", VMX_EPT_VIOLATION },
+	[EXIT_BENCH_PREEMPT]	= { "preemption_timer", VMX_PREEMPT },
+	[EXIT_BENCH_EXTINT]	= { "extint", VMX_EXTINT },
+};
+
+static volatile enum exit_bench_kind exit_bench_kind;
+static u8 *exit_bench_page;
+static u64 exit_bench_samples[EXIT_BENCH_ROUNDS];
+
+static void exit_bench_isr(isr_regs_t *regs)
+{
+	eoi();
+}
+
+static void exit_bench_guest(void)
+{
+	u64 rax;
+
+	while (exit_bench_kind != EXIT_BENCH_DONE) {
+		switch (exit_bench_kind) {
+		case EXIT_BENCH_CPUID:
+			raw_cpuid(0, 0);
+			break;
+		case EXIT_BENCH_VMCALL:
+			vmcall();
+			break;
+		case EXIT_BENCH_IO:
+			inb(0x80);
+			break;
+		case EXIT_BENCH_MSR:
+			rdmsr(MSR_EFER);
+			break;
+		case EXIT_BENCH_EPT:
+			/* Two bytes long, L1 skips it. */
+			rax = (u64)exit_bench_page;
+			asm volatile("mov (%%rax), %%al" : "+a"(rax) : : "memory");
+			break;
+		default:
+			pause();
+			break;
+		}
+	}
+}
+
+static void exit_bench_run(enum exit_bench_kind kind, bool shadow)
+{
+	u32 reason = exit_bench_kinds[kind].reason, got;
+	struct vmentry_result result;
+	struct bench_stats stats;
+	char name[48];
+	int i;
+	u64 t;
+
+	exit_bench_kind = kind;
+	if (kind == EXIT_BENCH_PREEMPT)
+		vmcs_set_bits(PIN_CONTROLS, PIN_PREEMPT);
+
+	for (i = 0; i < EXIT_BENCH_ROUNDS; i++) {
+		if (kind == EXIT_BENCH_PREEMPT)
+			vmcs_write(PREEMPT_TIMER_VALUE, 0);
+		else if (kind == EXIT_BENCH_EXTINT)
+			apic_icr_write(APIC_DEST_SELF | APIC_DEST_PHYSICAL |
+				       APIC_DM_FIXED | EXIT_BENCH_VECTOR, 0);
+
+		t = rdtsc();
+		__enter_guest(ABORT_ON_EARLY_VMENTRY_FAIL |
+			      ABORT_ON_INVALID_GUEST_STATE, &result);
+		exit_bench_samples[i] = rdtsc() - t;
+
+		got = result.exit_reason.basic;
+		TEST_ASSERT_EQ_MSG(reason, got, "Expected %s, got %s.",
+				   exit_reason_description(reason),
+				   exit_reason_description(got));
+
+		switch (kind) {
+		case EXIT_BENCH_EPT:
+			vmcs_write(GUEST_RIP, vmcs_read(GUEST_RIP) + 2);
+			break;
+		case EXIT_BENCH_PREEMPT:
+			break;
+		case EXIT_BENCH_EXTINT:
+			irq_enable();
+			asm volatile ("nop");
+			irq_disable();
+			break;
+		default:
+			skip_exit_insn();
+			break;
+		}
+	}
+
+	if (kind == EXIT_BENCH_PREEMPT)
+		vmcs_clear_bits(PIN_CONTROLS, PIN_PREEMPT);
+
+	bench_stats_compute(&stats, exit_bench_samples, EXIT_BENCH_ROUNDS);
+	snprintf(name, sizeof(name), "vmx_exit_%s%s",
+		 exit_bench_kinds[kind].name, shadow ? "_shadow" : "");
+	bench_report(name, "cycles", &stats);
+	report(true, "%s: %" PRIu64 " cycles median, %" PRIu64 " cycles p99",
+	       name, stats.p50, stats.p99);
+}
+
+static void exit_bench_run_all(bool ept, bool shadow)
+{
+	enum exit_bench_kind kind;
+
+	for (kind = 0; kind < EXIT_BENCH_DONE; kind++) {
+		if (kind == EXIT_BENCH_EPT && !ept)
+			continue;
+		if (kind == EXIT_BENCH_PREEMPT &&
+		    !(ctrl_pin_rev.clr & PIN_PREEMPT))
+			continue;
+		exit_bench_run(kind, shadow);
+	}
+}
+
+static void vmx_exit_bench(void)
+{
+	u8 *bitmap[2];
+	struct vmcs *shadow;
+	bool ept;
+
+	test_set_guest(exit_bench_guest);
+	handle_irq(EXIT_BENCH_VECTOR, exit_bench_isr);
+	irq_disable();
+
+	/* Not present in EPT, every access is an EPT violation. */
+	ept = !setup_ept(false);
+	if (ept) {
+		exit_bench_page = alloc_page();
+		install_ept(pml4, virt_to_phys(exit_bench_page),
+			    virt_to_phys(exit_bench_page), 0);
+		ept_sync(INVEPT_SINGLE, eptp);
+	} else {
+		report_skip("EPT violation: EPT not supported");
+	}
+	if (!(ctrl_pin_rev.clr & PIN_PREEMPT))
+		report_skip("preemption timer: not supported");
+
+	vmcs_set_bits(CPU_EXEC_CTRL0, CPU_IO);
+	exit_bench_run_all(ept, false);
+
+	if (!(ctrl_cpu_rev[0].clr & CPU_SECONDARY) ||
+	    !(ctrl_cpu_rev[1].clr & CPU_SHADOW_VMCS)) {
+		report_skip("VMCS shadowing not supported");
+	} else {
+		bitmap[ACCESS_VMREAD] = alloc_page();
+		bitmap[ACCESS_VMWRITE] = alloc_page();
+		vmcs_write(VMREAD_BITMAP, virt_to_phys(bitmap[ACCESS_VMREAD]));
+		vmcs_write(VMWRITE_BITMAP, virt_to_phys(bitmap[ACCESS_VMWRITE]));
+
+		shadow = alloc_page();
+		shadow->hdr.revision_id = basic.revision;
+		shadow->hdr.shadow_vmcs = 1;
+		TEST_ASSERT(!vmcs_clear(shadow));
+
+		vmcs_set_bits(CPU_EXEC_CTRL0, CPU_SECONDARY);
+		vmcs_set_bits(CPU_EXEC_CTRL1, CPU_SHADOW_VMCS);
+		vmcs_write(VMCS_LINK_PTR, virt_to_phys(shadow));
+		exit_bench_run_all(ept, true);
+	}
+
+	exit_bench_kind = EXIT_BENCH_DONE;
+	enter_guest();
+}
+
 #define TEST(name) { #name, .v2 = name }
 
 /* name/init/guest_main/exit_handler/syscall_handler/guest_regs */
@@ -9887,5 +10092,7 @@ struct vmx_test vmx_tests[] = {
 	TEST(atomic_switch_overflow_msrs_test),
 	TEST(rdtsc_vmexit_diff_test),
 	TEST(vmx_mtf_test),
+	/* Benchmarks */
+	TEST(vmx_exit_bench),
 	{ NULL, NULL, NULL, NULL, NULL, {0} },
 };